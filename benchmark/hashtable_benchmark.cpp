@@ -67,4 +67,847 @@ static void BM_InsertValuesSTLHashTable(benchmark::State &state)
 BENCHMARK(BM_InsertValuesSTLHashTable)->ThreadRange(1, 8);
 
 */
+#include "constexpr_map.hpp"
+#include "hash_table.hpp"
+#include "hash_table_frozen.hpp"
+#include "hash_table_lock_free.hpp"
+#include "hash_table_split_ordered.hpp"
+#include "interval_tree.hpp"
+#include "list.hpp"
+#include "memory.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <list>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#ifdef __linux__
+#include <fstream>
+#include <linux/perf_event.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+template <typename Table> static void BM_InsertDistinctKeys(benchmark::State &state)
+{
+    static Table *table = nullptr;
+    if (state.thread_index() == 0)
+    {
+        table = new Table();
+    }
+    // every thread inserts its own range of keys
+    size_t key = static_cast<size_t>(state.thread_index()) << 40;
+    for (auto _ : state)
+    {
+        table->insert({++key, key});
+    }
+    if (state.thread_index() == 0)
+    {
+        delete table;
+    }
+}
+BENCHMARK_TEMPLATE(BM_InsertDistinctKeys, lf::HashTable<size_t, size_t>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_InsertDistinctKeys, lf::FlatHashTable<size_t, size_t>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_InsertDistinctKeys, lf::PackedHashTable<size_t, size_t>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_InsertDistinctKeys, lf::SplitOrderedHashTable<size_t, size_t>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_InsertDistinctKeys, lf::HashTable<size_t, size_t, std::hash<size_t>, std::equal_to<size_t>,
+                                                       memory::pool_allocator<std::pair<size_t, size_t>>>)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
+// loads state.range(0) pairs, one insert per pair against the bulk build constructor on state.range(1) threads
+template <typename Table> static void BM_BulkBuild(benchmark::State &state)
+{
+    std::vector<std::pair<size_t, size_t>> values(state.range(0));
+    std::mt19937_64 rng(3);
+    for (auto &value : values)
+    {
+        value = {rng(), 0};
+    }
+    for (auto _ : state)
+    {
+        if (state.range(1) == 0)
+        {
+            Table table(values.size() * 2);
+            for (const auto &value : values)
+            {
+                table.insert(value);
+            }
+            benchmark::DoNotOptimize(table.size());
+        }
+        else
+        {
+            Table table(values.begin(), values.end(), state.range(1));
+            benchmark::DoNotOptimize(table.size());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK_TEMPLATE(BM_BulkBuild, lf::HashTable<size_t, size_t>)
+    ->ArgsProduct({{1 << 20}, {0, 1, 4}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BulkBuild, lf::FlatHashTable<size_t, size_t>)
+    ->ArgsProduct({{1 << 20}, {0, 1, 4}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// fixed field table looked up with runtime keys: compiled layouts against the map built at startup
+static constexpr std::pair<std::string_view, int> field_tags[] = {
+    {"BeginString", 8},   {"BodyLength", 9},    {"MsgType", 35},    {"SenderCompID", 49}, {"TargetCompID", 56},
+    {"MsgSeqNum", 34},    {"SendingTime", 52},  {"CheckSum", 10},   {"ClOrdID", 11},      {"OrderID", 37},
+    {"Symbol", 55},       {"Side", 54},         {"OrderQty", 38},   {"OrdType", 40},      {"Price", 44},
+    {"TimeInForce", 59},  {"TransactTime", 60}, {"ExecType", 150},  {"OrdStatus", 39},    {"LeavesQty", 151},
+    {"CumQty", 14},       {"AvgPx", 6},         {"Text", 58},       {"Account", 1},       {"HandlInst", 21},
+    {"ExecID", 17},       {"LastPx", 31},       {"LastQty", 32},    {"OrigClOrdID", 41},  {"SecurityID", 48},
+    {"HeartBtInt", 108},  {"EncryptMethod", 98}};
+
+template <typename Map> static void BM_FixedTableLookup(benchmark::State &state, const Map &map)
+{
+    std::mt19937_64 rng(5);
+    std::vector<std::string_view> keys(1 << 12);
+    for (auto &key : keys)
+    {
+        key = field_tags[rng() % std::size(field_tags)].first;
+    }
+    for (auto _ : state)
+    {
+        int sum = 0;
+        for (auto key : keys)
+        {
+            sum += *map.find(key);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+static void BM_FixedTableConstexprHash(benchmark::State &state)
+{
+    static constexpr auto map = make_constexpr_hash_map(field_tags);
+    BM_FixedTableLookup(state, map);
+}
+BENCHMARK(BM_FixedTableConstexprHash);
+
+static void BM_FixedTableConstexprSorted(benchmark::State &state)
+{
+    static constexpr auto map = make_constexpr_sorted_map(field_tags);
+    BM_FixedTableLookup(state, map);
+}
+BENCHMARK(BM_FixedTableConstexprSorted);
+
+struct startup_fields
+{
+    const int *find(std::string_view key) const
+    {
+        return &_M_map.find(key)->second;
+    }
+
+    std::unordered_map<std::string_view, int> _M_map{std::begin(field_tags), std::end(field_tags)};
+};
+
+static void BM_FixedTableUnorderedMap(benchmark::State &state)
+{
+    static const startup_fields map;
+    BM_FixedTableLookup(state, map);
+}
+BENCHMARK(BM_FixedTableUnorderedMap);
+
+// worst single insert while the table grows from 2^10 buckets to state.range(0) elements
+template <typename Table> static void BM_GrowMaxLatency(benchmark::State &state)
+{
+    const auto count = static_cast<size_t>(state.range(0));
+    double worst = 0;
+    for (auto _ : state)
+    {
+        Table table(1 << 10);
+        for (size_t key = 0; key < count; ++key)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            table.insert({key, key});
+            const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+            worst = std::max(worst, elapsed.count());
+        }
+    }
+    state.counters["max_insert_us"] = worst;
+}
+BENCHMARK_TEMPLATE(BM_GrowMaxLatency, lf::HashTable<size_t, size_t>)->Arg(1 << 20)->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_GrowMaxLatency, lf::FlatHashTable<size_t, size_t>)->Arg(1 << 20)->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_GrowMaxLatency, lf::SplitOrderedHashTable<size_t, size_t>)->Arg(1 << 20)->Iterations(1)->Unit(benchmark::kMillisecond);
+
+// random lookups on a table far bigger than the caches, state.range(0) keys per call (1 is the single key path)
+template <typename Table> static Table &lookup_table()
+{
+    static Table *table = [] {
+        auto ret = new Table(1 << 23);
+        for (size_t key = 0; key < (1 << 22); ++key)
+        {
+            ret->insert({key, key});
+        }
+        return ret;
+    }();
+    return *table;
+}
+
+struct key_view
+{
+    const size_t *data() const
+    {
+        return _M_data;
+    }
+
+    size_t size() const
+    {
+        return _M_size;
+    }
+
+    const size_t *_M_data;
+    size_t _M_size;
+};
+
+template <typename Table> static void BM_FindRandom(benchmark::State &state)
+{
+    auto &table = lookup_table<Table>();
+    const size_t batch = state.range(0);
+    std::mt19937_64 rng(42);
+    std::vector<size_t> keys(1 << 16);
+    for (auto &key : keys)
+    {
+        key = rng() % (1 << 22);
+    }
+    std::vector<char> found(batch);
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < keys.size(); i += batch)
+        {
+            if (batch == 1)
+            {
+                found[0] = table.find(keys[i]).has_value();
+            }
+            else
+            {
+                table.find_batch(key_view{keys.data() + i, batch}, found.begin());
+            }
+            benchmark::DoNotOptimize(found.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK_TEMPLATE(BM_FindRandom, lf::HashTable<size_t, size_t>)->Arg(1)->Arg(64)->Arg(256);
+BENCHMARK_TEMPLATE(BM_FindRandom, lf::FlatHashTable<size_t, size_t>)->Arg(1)->Arg(64)->Arg(256);
+
+// data TLB read misses of the calling thread, not valid where perf events are not available
+struct dtlb_counter
+{
+    dtlb_counter()
+    {
+#ifdef __linux__
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _M_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~dtlb_counter()
+    {
+#ifdef __linux__
+        if (valid())
+        {
+            close(_M_fd);
+        }
+#endif
+    }
+
+    bool valid() const
+    {
+        return _M_fd >= 0;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        if (valid())
+        {
+            ioctl(_M_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(_M_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t stop()
+    {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (valid())
+        {
+            ioctl(_M_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(_M_fd, &count, sizeof(count)) != sizeof(count))
+            {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+    int _M_fd = -1;
+};
+
+// anonymous memory of the process backed by transparent huge pages
+static double anon_huge_mib()
+{
+#ifdef __linux__
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    std::string field;
+    double kib;
+    while (rollup >> field)
+    {
+        if (field == "AnonHugePages:" && rollup >> kib)
+        {
+            return kib / 1024;
+        }
+    }
+#endif
+    return 0;
+}
+
+/*
+   Single key random lookups on the lookup table with the dTLB misses per
+   find, with the buckets on normal pages and on huge pages.
+*/
+template <typename Table> static void BM_FindRandomTLB(benchmark::State &state)
+{
+    auto &table = lookup_table<Table>();
+    std::mt19937_64 rng(42);
+    std::vector<size_t> keys(1 << 16);
+    for (auto &key : keys)
+    {
+        key = rng() % (1 << 22);
+    }
+    dtlb_counter counter;
+    counter.start();
+    for (auto _ : state)
+    {
+        for (auto key : keys)
+        {
+            benchmark::DoNotOptimize(table.find(key).has_value());
+        }
+    }
+    const auto misses = counter.stop();
+    const auto finds = state.iterations() * keys.size();
+    state.SetItemsProcessed(finds);
+    if (counter.valid())
+    {
+        state.counters["dTLB_miss/find"] = static_cast<double>(misses) / finds;
+    }
+    state.counters["huge_MiB"] = anon_huge_mib();
+}
+template <typename Key, typename Value>
+using huge_page_pairs = memory::huge_page_allocator<std::pair<Key, Value>>;
+BENCHMARK_TEMPLATE(BM_FindRandomTLB, lf::HashTable<size_t, size_t>);
+BENCHMARK_TEMPLATE(BM_FindRandomTLB, lf::HashTable<size_t, size_t, std::hash<size_t>, std::equal_to<size_t>,
+                                                   huge_page_pairs<size_t, size_t>>);
+BENCHMARK_TEMPLATE(BM_FindRandomTLB, lf::FlatHashTable<size_t, size_t>);
+BENCHMARK_TEMPLATE(BM_FindRandomTLB, lf::FlatHashTable<size_t, size_t, std::hash<size_t>, std::equal_to<size_t>,
+                                                       huge_page_pairs<size_t, size_t>>);
+
+// warm start: map the frozen image of the lookup table and answer random lookups from it
+static void BM_FrozenOpenFind(benchmark::State &state)
+{
+    using frozen = lf::FrozenHashTable<size_t, size_t>;
+    static const bool written = [] {
+        std::vector<std::pair<size_t, size_t>> values;
+        for (size_t key = 0; key < (1 << 22); ++key)
+        {
+            values.push_back({key, key});
+        }
+        return frozen::write("frozen_benchmark.img", frozen::build(values.begin(), values.end()));
+    }();
+    std::mt19937_64 rng(42);
+    for (auto _ : state)
+    {
+        auto table = frozen::open("frozen_benchmark.img");
+        size_t found = 0;
+        for (int i = 0; i < state.range(0); ++i)
+        {
+            found += table.find(rng() % (1 << 22)).has_value();
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.counters["written"] = written;
+}
+BENCHMARK(BM_FrozenOpenFind)->Arg(1)->Arg(1 << 16)->Unit(benchmark::kMicrosecond);
+
+// every thread looks up random keys of the same table, throughput should grow with the thread count
+template <typename Table> static void BM_FindShared(benchmark::State &state)
+{
+    auto &table = lookup_table<Table>();
+    std::mt19937_64 rng(state.thread_index());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(table.find(rng() % (1 << 22)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_FindShared, lf::HashTable<size_t, size_t>)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FindShared, lf::PaddedHashTable<size_t, size_t>)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FindShared, lf::FlatHashTable<size_t, size_t>)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_FindShared, lf::PackedHashTable<size_t, size_t>)->ThreadRange(1, 64)->UseRealTime();
+
+// single threaded scratch map: fill with state.range(0) random keys, then look every key up once
+template <typename Map> static void BM_ScratchMap(benchmark::State &state)
+{
+    std::mt19937_64 rng(7);
+    std::vector<size_t> keys(state.range(0));
+    for (auto &key : keys)
+    {
+        key = rng();
+    }
+    for (auto _ : state)
+    {
+        Map map;
+        for (auto key : keys)
+        {
+            map.insert({key, key});
+        }
+        size_t sum = 0;
+        for (auto key : keys)
+        {
+            sum += map.find(key)->second;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK_TEMPLATE(BM_ScratchMap, xhash_table<size_t, size_t>)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(BM_ScratchMap, std::unordered_map<size_t, size_t>)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+
+// flush: walk a map of state.range(0) keys in insertion order; the linked layout is a list of pairs
+// indexed by a hash map of list iterators
+struct linked_dict
+{
+    void insert(const std::pair<size_t, size_t> &value)
+    {
+        if (_M_index.find(value.first) == _M_index.end())
+        {
+            _M_index[value.first] = _M_values.insert(_M_values.end(), value);
+        }
+    }
+
+    std::list<std::pair<size_t, size_t>>::iterator begin()
+    {
+        return _M_values.begin();
+    }
+
+    std::list<std::pair<size_t, size_t>>::iterator end()
+    {
+        return _M_values.end();
+    }
+
+    std::list<std::pair<size_t, size_t>> _M_values;
+    std::unordered_map<size_t, std::list<std::pair<size_t, size_t>>::iterator> _M_index;
+};
+
+template <typename Map> static void BM_OrderedFlush(benchmark::State &state)
+{
+    std::mt19937_64 rng(13);
+    Map map;
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        map.insert({rng(), i});
+    }
+    for (auto _ : state)
+    {
+        size_t sum = 0;
+        for (auto &value : map)
+        {
+            sum += value.second;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_OrderedFlush, ordered_xhash_table<size_t, size_t>)->Arg(1 << 10)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(BM_OrderedFlush, linked_dict)->Arg(1 << 10)->Arg(1 << 20);
+
+// lookups in a static set of state.range(0) random keys, half of the lookups miss
+template <typename Map> static void BM_StaticLookup(benchmark::State &state)
+{
+    std::mt19937_64 rng(11);
+    std::vector<std::pair<size_t, size_t>> values(state.range(0));
+    for (auto &value : values)
+    {
+        value = {rng() | 1, 0};
+    }
+    Map map(values.begin(), values.end());
+    std::vector<size_t> keys(1 << 16);
+    for (auto &key : keys)
+    {
+        key = values[rng() % values.size()].first ^ (rng() & 1);
+    }
+    for (auto _ : state)
+    {
+        size_t found = 0;
+        for (auto key : keys)
+        {
+            found += map.contains(key);
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template <typename Map> struct static_adapter
+{
+    template <typename It> static_adapter(It first, It last)
+    {
+        for (; first != last; ++first)
+        {
+            _M_map.insert(*first);
+        }
+    }
+
+    bool contains(size_t key)
+    {
+        return _M_map.find(key) != _M_map.end();
+    }
+
+    Map _M_map;
+};
+
+struct perfect_adapter : perfect_hash_map<size_t, size_t>
+{
+    using perfect_hash_map::perfect_hash_map;
+
+    bool contains(size_t key) const
+    {
+        return find(key) != nullptr;
+    }
+};
+BENCHMARK_TEMPLATE(BM_StaticLookup, perfect_adapter)->Arg(1 << 10)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(BM_StaticLookup, static_adapter<xhash_table<size_t, size_t>>)->Arg(1 << 10)->Arg(1 << 20);
+BENCHMARK_TEMPLATE(BM_StaticLookup, static_adapter<std::unordered_map<size_t, size_t>>)->Arg(1 << 10)->Arg(1 << 20);
+
+// shared counters bumped by every thread, against the mutex guarded map they replace; the
+// 1024 keys live in neighbouring buckets so packed buckets false share between writers
+struct LockedCounters
+{
+    explicit LockedCounters(size_t)
+    {
+    }
+
+    size_t fetch_add(size_t key, size_t delta)
+    {
+        std::lock_guard<std::mutex> guard(_M_mutex);
+        auto &value = _M_map[key];
+        auto previous = value;
+        value += delta;
+        return previous;
+    }
+
+    std::mutex _M_mutex;
+    std::unordered_map<size_t, size_t> _M_map;
+};
+
+template <typename Table> static void BM_CounterFetchAdd(benchmark::State &state)
+{
+    static Table *table = nullptr;
+    if (state.thread_index() == 0)
+    {
+        table = new Table(1 << 12);
+    }
+    std::mt19937_64 rng(state.thread_index());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(table->fetch_add(rng() % 1024, 1));
+    }
+    if (state.thread_index() == 0)
+    {
+        delete table;
+    }
+}
+BENCHMARK_TEMPLATE(BM_CounterFetchAdd, lf::HashTable<size_t, size_t>)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_CounterFetchAdd, lf::PaddedHashTable<size_t, size_t>)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_CounterFetchAdd, lf::FlatHashTable<size_t, size_t>)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_CounterFetchAdd, lf::PackedHashTable<size_t, size_t>)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_CounterFetchAdd, LockedCounters)->ThreadRange(1, 64)->UseRealTime();
+
+struct churn_node
+{
+    churn_node *_M_next;
+    size_t _M_payload[5];
+};
+
+template <typename T> struct malloc_allocator
+{
+    using value_type = T;
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(std::malloc(n * sizeof(T)));
+    }
+
+    void deallocate(T *ptr, size_t)
+    {
+        std::free(ptr);
+    }
+};
+
+/*
+   Every thread allocates a batch of nodes, hands it to the mailbox of the
+   next thread and frees the batches it received, so with more than one
+   thread each node is freed by another thread than the one allocating it.
+   The last thread out of the loop empties every mailbox, no node is left
+   for the next run.
+*/
+template <typename Allocator> static void BM_ProducerConsumerChurn(benchmark::State &state)
+{
+    struct alignas(64) mailbox
+    {
+        std::atomic<churn_node *> _M_head{nullptr};
+    };
+    static mailbox mailboxes[64];
+    static std::atomic<int> finished{0};
+    constexpr size_t batch = 64;
+    Allocator allocator;
+    auto &inbox = mailboxes[state.thread_index()];
+    auto &outbox = mailboxes[(state.thread_index() + 1) % state.threads()];
+    auto drain = [&](mailbox &box) {
+        auto node = box._M_head.exchange(nullptr);
+        while (node)
+        {
+            auto next = node->_M_next;
+            allocator.deallocate(node, 1);
+            node = next;
+        }
+    };
+    for (auto _ : state)
+    {
+        churn_node *first = nullptr;
+        churn_node *last = nullptr;
+        for (size_t i = 0; i < batch; ++i)
+        {
+            auto node = allocator.allocate(1);
+            node->_M_next = first;
+            node->_M_payload[0] = i;
+            first = node;
+            last = last ? last : node;
+        }
+        last->_M_next = outbox._M_head.load();
+        while (!outbox._M_head.compare_exchange_weak(last->_M_next, first))
+        {
+        }
+        drain(inbox);
+    }
+    // every other thread has pushed its last batch
+    if (finished.fetch_add(1) + 1 == state.threads())
+    {
+        for (int i = 0; i < state.threads(); ++i)
+        {
+            drain(mailboxes[i]);
+        }
+        finished.store(0);
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK_TEMPLATE(BM_ProducerConsumerChurn, memory::slab_allocator<churn_node>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ProducerConsumerChurn, std::allocator<churn_node>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ProducerConsumerChurn, malloc_allocator<churn_node>)->ThreadRange(1, 8)->UseRealTime();
+
+/*
+   Builds a tree or a list of state.range(0) nodes and drops it. With the
+   arena the nodes are pointer bumps and dropping them is one release.
+*/
+template <typename Container> static void BM_BuildAndDrop(benchmark::State &state)
+{
+    const auto count = static_cast<int>(state.range(0));
+    for (auto _ : state)
+    {
+        memory::MonotonicArena arena;
+        {
+            auto container = Container::make(arena);
+            for (int i = 0; i < count; ++i)
+            {
+                container.insert(i);
+            }
+            benchmark::DoNotOptimize(container.size());
+        }
+        arena.release();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+template <typename Allocator> struct tree_under_test
+{
+    static tree_under_test make(memory::MonotonicArena &arena)
+    {
+        if constexpr (std::is_same<Allocator, memory::arena_allocator<int>>::value)
+        {
+            return {OSIntervalTree<int, int, Allocator>(Allocator(arena))};
+        }
+        else
+        {
+            return {OSIntervalTree<int, int, Allocator>()};
+        }
+    }
+
+    void insert(int value)
+    {
+        _M_tree.insert(value, value);
+    }
+
+    size_t size() const
+    {
+        return _M_tree.m_size;
+    }
+
+    OSIntervalTree<int, int, Allocator> _M_tree;
+};
+
+template <typename Allocator> struct list_under_test
+{
+    static list_under_test make(memory::MonotonicArena &arena)
+    {
+        if constexpr (std::is_same<Allocator, memory::arena_allocator<int>>::value)
+        {
+            return {List<int, Allocator>(Allocator(arena))};
+        }
+        else
+        {
+            return {List<int, Allocator>()};
+        }
+    }
+
+    void insert(int value)
+    {
+        _M_list.push_back(value);
+    }
+
+    size_t size() const
+    {
+        return _M_list.size();
+    }
+
+    List<int, Allocator> _M_list;
+};
+BENCHMARK_TEMPLATE(BM_BuildAndDrop, tree_under_test<std::allocator<int>>)->Arg(1 << 10)->Arg(1 << 18);
+BENCHMARK_TEMPLATE(BM_BuildAndDrop, tree_under_test<memory::arena_allocator<int>>)->Arg(1 << 10)->Arg(1 << 18);
+BENCHMARK_TEMPLATE(BM_BuildAndDrop, list_under_test<std::allocator<int>>)->Arg(1 << 10)->Arg(1 << 18);
+BENCHMARK_TEMPLATE(BM_BuildAndDrop, list_under_test<memory::arena_allocator<int>>)->Arg(1 << 10)->Arg(1 << 18);
+
+// configuration snapshot read by every thread and republished by thread 0 every 64 reads
+struct snapshot_config
+{
+    size_t _M_version;
+    size_t _M_limits[7];
+};
+
+struct counted_snapshot
+{
+    counted_snapshot() : _M_current(memory::make_counted<snapshot_config>())
+    {
+    }
+
+    size_t read()
+    {
+        return _M_current.load()->_M_version;
+    }
+
+    void publish(size_t version)
+    {
+        _M_current.store(memory::make_counted<snapshot_config>(snapshot_config{version, {}}));
+    }
+
+    memory::atomic_counted_ptr<snapshot_config> _M_current;
+};
+
+struct locked_snapshot
+{
+    size_t read()
+    {
+        std::shared_ptr<snapshot_config> current;
+        {
+            std::lock_guard<std::mutex> guard(_M_mutex);
+            current = _M_current;
+        }
+        return current->_M_version;
+    }
+
+    void publish(size_t version)
+    {
+        auto next = std::make_shared<snapshot_config>(snapshot_config{version, {}});
+        std::lock_guard<std::mutex> guard(_M_mutex);
+        _M_current.swap(next);
+    }
+
+    std::mutex _M_mutex;
+    std::shared_ptr<snapshot_config> _M_current = std::make_shared<snapshot_config>();
+};
+
+// the free atomic functions on shared_ptr, lock based in libstdc++ and deprecated in C++20
+struct atomic_shared_snapshot
+{
+    size_t read()
+    {
+        return std::atomic_load(&_M_current)->_M_version;
+    }
+
+    void publish(size_t version)
+    {
+        std::atomic_store(&_M_current, std::make_shared<snapshot_config>(snapshot_config{version, {}}));
+    }
+
+    std::shared_ptr<snapshot_config> _M_current = std::make_shared<snapshot_config>();
+};
+
+template <typename Snapshot> static void BM_SnapshotPublish(benchmark::State &state)
+{
+    static Snapshot *snapshot = nullptr;
+    if (state.thread_index() == 0)
+    {
+        snapshot = new Snapshot();
+    }
+    size_t reads = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(snapshot->read());
+        if (state.thread_index() == 0 && ++reads % 64 == 0)
+        {
+            snapshot->publish(reads);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0)
+    {
+        delete snapshot;
+    }
+}
+BENCHMARK_TEMPLATE(BM_SnapshotPublish, counted_snapshot)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SnapshotPublish, locked_snapshot)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SnapshotPublish, atomic_shared_snapshot)->ThreadRange(1, 8)->UseRealTime();
+
+// copies and drops of a pointer only its creating thread touches, the common case for biased counts
+template <typename Policy> static void BM_RefCountCopy(benchmark::State &state)
+{
+    memory::SmartPtr<size_t, Policy> ptr(size_t(1));
+    for (auto _ : state)
+    {
+        memory::SmartPtr<size_t, Policy> copy(ptr);
+        benchmark::DoNotOptimize(*copy);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_RefCountCopy, memory::RefCount)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_RefCountCopy, memory::BiasedRefCount)->ThreadRange(1, 8)->UseRealTime();
+
 BENCHMARK_MAIN();
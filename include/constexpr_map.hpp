@@ -0,0 +1,313 @@
+#ifndef __CONSTEXPR_MAP__
+#define __CONSTEXPR_MAP__
+
+#include<algorithm>
+#include<array>
+#include<cstddef>
+#include<cstdint>
+#include<functional>
+#include<string_view>
+#include<type_traits>
+#include<utility>
+
+/*
+   Hash usable in constant expressions, std::hash is not. Integers and enums
+   hash to themselves (the maps mix the hash), strings with FNV-1a.
+*/
+template<typename KeyT, typename = void>
+struct constexpr_hash;
+
+template<typename KeyT>
+struct constexpr_hash<KeyT, std::enable_if_t<std::is_integral<KeyT>::value || std::is_enum<KeyT>::value>>
+{
+	constexpr uint64_t operator()(KeyT key) const
+	{
+		return static_cast<uint64_t>(key);
+	}
+};
+
+template<>
+struct constexpr_hash<std::string_view>
+{
+	constexpr uint64_t operator()(std::string_view key) const
+	{
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for(auto c : key)
+		{
+			hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+		}
+		return hash;
+	}
+};
+
+// key/value pair of the constexpr maps, std::pair is not assignable in constant expressions before C++20
+template<typename KeyT, typename ValueT>
+struct constexpr_entry
+{
+	KeyT first{};
+	ValueT second{};
+};
+
+/*
+   Hash map built at compile time from a fixed list of pairs, a key that
+   repeats keeps its first value. The layout is a two level perfect hash
+   (CHD style): a key picks a bucket with seed 0, a bucket with one key
+   stores its slot and a bigger bucket stores the seed that sends all its
+   keys to free slots, found while compiling with the biggest buckets
+   first. A lookup hashes twice and compares one slot, on a literal key in
+   a constant expression it folds to a constant.
+*/
+template<typename KeyT, typename ValueT, size_t N, typename HashFuncT = constexpr_hash<KeyT>,
+	typename KeyEqualT = std::equal_to<KeyT>>
+class constexpr_hash_map
+{
+	public:
+	using value_type = constexpr_entry<KeyT, ValueT>;
+
+	static constexpr size_t capacity()
+	{
+		size_t ret = 1;
+		while(ret < N)
+		{
+			ret <<= 1;
+		}
+		return ret;
+	}
+
+	constexpr explicit constexpr_hash_map(const std::pair<KeyT, ValueT> (&values)[N])
+	{
+		constexpr size_t mask = capacity() - 1;
+		std::array<uint64_t, N> hash{};
+		std::array<size_t, N> bucket{};
+		std::array<bool, N> kept{};
+		std::array<size_t, capacity()> load{};
+		size_t biggest = 0;
+		for(size_t i = 0; i < N; ++i)
+		{
+			kept[i] = true;
+			for(size_t j = 0; j < i && kept[i]; ++j)
+			{
+				kept[i] = !(kept[j] && KeyEqualT()(values[j].first, values[i].first));
+			}
+			if(kept[i])
+			{
+				hash[i] = HashFuncT()(values[i].first);
+				bucket[i] = mix(hash[i], 0) & mask;
+				biggest = std::max(biggest, ++load[bucket[i]]);
+				++_M_size;
+			}
+		}
+
+		size_t next_free = 0;
+		for(size_t size = biggest; size > 0; --size)
+		{
+			for(size_t b = 0; b < capacity(); ++b)
+			{
+				if(load[b] != size)
+				{
+					continue;
+				}
+				if(size == 1)
+				{
+					while(_M_used[next_free])
+					{
+						++next_free;
+					}
+					for(size_t i = 0; i < N; ++i)
+					{
+						if(kept[i] && bucket[i] == b)
+						{
+							place(values[i], next_free);
+						}
+					}
+					_M_seeds[b] = -static_cast<int64_t>(next_free) - 1;
+					continue;
+				}
+				for(int64_t seed = 1;; ++seed)
+				{
+					if(try_seed(values, hash, bucket, kept, b, seed))
+					{
+						_M_seeds[b] = seed;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// the value of key, nullptr when key is not in the map
+	constexpr const ValueT* find(const KeyT& key) const
+	{
+		const auto hash = HashFuncT()(key);
+		const auto seed = _M_seeds[mix(hash, 0) & (capacity() - 1)];
+		if(seed == 0)
+		{
+			return nullptr;
+		}
+		const auto slot = seed < 0 ? static_cast<size_t>(-seed - 1) :
+			mix(hash, static_cast<uint64_t>(seed)) & (capacity() - 1);
+		return _M_used[slot] && KeyEqualT()(_M_slots[slot].first, key) ? &_M_slots[slot].second : nullptr;
+	}
+
+	constexpr bool contains(const KeyT& key) const
+	{
+		return find(key) != nullptr;
+	}
+
+	constexpr size_t size() const
+	{
+		return _M_size;
+	}
+
+	private:
+	static constexpr uint64_t mix(uint64_t hash, uint64_t seed)
+	{
+		hash ^= seed * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	constexpr void place(const std::pair<KeyT, ValueT>& value, size_t slot)
+	{
+		_M_slots[slot].first = value.first;
+		_M_slots[slot].second = value.second;
+		_M_used[slot] = true;
+	}
+
+	// places the keys of bucket b when seed sends them to distinct free slots
+	constexpr bool try_seed(const std::pair<KeyT, ValueT> (&values)[N], const std::array<uint64_t, N>& hash,
+		const std::array<size_t, N>& bucket, const std::array<bool, N>& kept, size_t b, int64_t seed)
+	{
+		std::array<bool, capacity()> taken = _M_used;
+		for(size_t i = 0; i < N; ++i)
+		{
+			if(kept[i] && bucket[i] == b)
+			{
+				const auto slot = mix(hash[i], static_cast<uint64_t>(seed)) & (capacity() - 1);
+				if(taken[slot])
+				{
+					return false;
+				}
+				taken[slot] = true;
+			}
+		}
+		for(size_t i = 0; i < N; ++i)
+		{
+			if(kept[i] && bucket[i] == b)
+			{
+				place(values[i], mix(hash[i], static_cast<uint64_t>(seed)) & (capacity() - 1));
+			}
+		}
+		return true;
+	}
+
+	std::array<value_type, capacity()> _M_slots{};
+	std::array<bool, capacity()> _M_used{};
+	// 0 for an empty bucket, -slot - 1 for a bucket of one key
+	std::array<int64_t, capacity()> _M_seeds{};
+	size_t _M_size = 0;
+};
+
+/*
+   Sorted map built at compile time, the pairs are kept in one array in
+   CompareT order and found by binary search. A key that repeats keeps its
+   first value.
+*/
+template<typename KeyT, typename ValueT, size_t N, typename CompareT = std::less<KeyT>>
+class constexpr_sorted_map
+{
+	public:
+	using value_type = constexpr_entry<KeyT, ValueT>;
+	using const_iterator = const value_type*;
+
+	constexpr explicit constexpr_sorted_map(const std::pair<KeyT, ValueT> (&values)[N])
+	{
+		for(size_t i = 0; i < N; ++i)
+		{
+			const auto at = static_cast<size_t>(lower_bound(values[i].first) - begin());
+			if(at < _M_size && !CompareT()(values[i].first, _M_slots[at].first))
+			{
+				continue;
+			}
+			for(size_t j = _M_size; j > at; --j)
+			{
+				_M_slots[j] = _M_slots[j - 1];
+			}
+			_M_slots[at].first = values[i].first;
+			_M_slots[at].second = values[i].second;
+			++_M_size;
+		}
+	}
+
+	// first pair whose key is not ordered before key
+	constexpr const_iterator lower_bound(const KeyT& key) const
+	{
+		size_t first = 0;
+		size_t count = _M_size;
+		while(count > 0)
+		{
+			const auto half = count / 2;
+			if(CompareT()(_M_slots[first + half].first, key))
+			{
+				first += half + 1;
+				count -= half + 1;
+			}
+			else
+			{
+				count = half;
+			}
+		}
+		return begin() + first;
+	}
+
+	// the value of key, nullptr when key is not in the map
+	constexpr const ValueT* find(const KeyT& key) const
+	{
+		const auto it = lower_bound(key);
+		return it != end() && !CompareT()(key, it->first) ? &it->second : nullptr;
+	}
+
+	constexpr bool contains(const KeyT& key) const
+	{
+		return find(key) != nullptr;
+	}
+
+	constexpr const_iterator begin() const
+	{
+		return _M_slots.data();
+	}
+
+	constexpr const_iterator end() const
+	{
+		return _M_slots.data() + _M_size;
+	}
+
+	constexpr size_t size() const
+	{
+		return _M_size;
+	}
+
+	private:
+	std::array<value_type, N> _M_slots{};
+	size_t _M_size = 0;
+};
+
+// make_constexpr_hash_map<int, const char*>({{1, "one"}, {2, "two"}}), the size is deduced
+template<typename KeyT, typename ValueT, typename HashFuncT = constexpr_hash<KeyT>,
+	typename KeyEqualT = std::equal_to<KeyT>, size_t N>
+constexpr auto make_constexpr_hash_map(const std::pair<KeyT, ValueT> (&values)[N])
+{
+	return constexpr_hash_map<KeyT, ValueT, N, HashFuncT, KeyEqualT>(values);
+}
+
+template<typename KeyT, typename ValueT, typename CompareT = std::less<KeyT>, size_t N>
+constexpr auto make_constexpr_sorted_map(const std::pair<KeyT, ValueT> (&values)[N])
+{
+	return constexpr_sorted_map<KeyT, ValueT, N, CompareT>(values);
+}
+
+#endif
@@ -1,124 +1,1016 @@
 #ifndef __HASH_TABLE__
 #define __HASH_TABLE__
 
+#include<algorithm>
+#include<cstdint>
+#include<cstring>
+#include<functional>
+#include<iostream>
+#include<iterator>
+#include<memory>
+#include<utility>
 #include<vector>
-#include<list>
+#include "memory.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XHASH_TABLE_SSE2
+#include<emmintrin.h>
+#endif
+
+/*
+   Control bytes of a group of 16 slots, matched all at once with SSE2 (a
+   plain loop elsewhere). A full slot keeps the low 7 bits of its hash, the
+   empty and deleted markers have the high bit set.
+*/
+struct xhash_group
+{
+	static constexpr size_t width = 16;
+	static constexpr int8_t empty = -128;
+	static constexpr int8_t deleted = -2;
+
+	explicit xhash_group(const int8_t* ctrl) : _M_ctrl(ctrl)
+	{
+	}
+
+	// one bit per slot whose control byte equals tag
+	uint32_t match(int8_t tag) const
+	{
+#ifdef XHASH_TABLE_SSE2
+		auto ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_M_ctrl));
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), ctrl)));
+#else
+		uint32_t bits = 0;
+		for(size_t i = 0; i < width; ++i)
+		{
+			bits |= uint32_t(_M_ctrl[i] == tag) << i;
+		}
+		return bits;
+#endif
+	}
+
+	uint32_t match_empty() const
+	{
+		return match(empty);
+	}
+
+	uint32_t match_empty_or_deleted() const
+	{
+#ifdef XHASH_TABLE_SSE2
+		auto ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_M_ctrl));
+		return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+		uint32_t bits = 0;
+		for(size_t i = 0; i < width; ++i)
+		{
+			bits |= uint32_t(_M_ctrl[i] < 0) << i;
+		}
+		return bits;
+#endif
+	}
+
+	static size_t lowest(uint32_t bits)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return static_cast<size_t>(__builtin_ctz(bits));
+#else
+		size_t index = 0;
+		while(!(bits & 1))
+		{
+			bits >>= 1;
+			++index;
+		}
+		return index;
+#endif
+	}
+
+	const int8_t* _M_ctrl;
+};
+
+/*
+   Single threaded open addressing table (Swiss table layout): the control
+   bytes live in their own array and key/value pairs are stored inline in a
+   parallel slot array, a probe touches one control group and then only the
+   slots whose tag matched. Groups are probed triangularly and the table keeps
+   at most 7/8 of the slots in use. Iterators are invalidated by a rehash.
+*/
 template<typename KeyT, typename ValueT, typename HashFuncT = std::hash<KeyT>>
 struct xhash_table {
 	using value_type = std::pair<KeyT, ValueT>;
-	using list_type = std::list<value_type>;
-	using iterator = typename list_type::iterator;
-	using bulk_type = std::vector<std::list<iterator>>;
+	using allocator_type = std::allocator<value_type>;
+	using alloc_traits = std::allocator_traits<allocator_type>;
+
+	struct iterator
+	{
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = typename xhash_table::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = value_type*;
+		using reference = value_type&;
+
+		iterator() = default;
+
+		iterator(xhash_table* table, size_t index) : _M_table(table), _M_index(index)
+		{
+			skip();
+		}
+
+		reference operator*() const
+		{
+			return _M_table->_M_slots[_M_index];
+		}
+
+		pointer operator->() const
+		{
+			return &_M_table->_M_slots[_M_index];
+		}
+
+		iterator& operator++()
+		{
+			++_M_index;
+			skip();
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			auto ret = *this;
+			++*this;
+			return ret;
+		}
+
+		bool operator==(const iterator& rhs) const
+		{
+			return _M_index == rhs._M_index;
+		}
+
+		bool operator!=(const iterator& rhs) const
+		{
+			return _M_index != rhs._M_index;
+		}
+
+		private:
+		void skip()
+		{
+			while(_M_index < _M_table->_M_capacity && _M_table->_M_ctrl[_M_index] < 0)
+			{
+				++_M_index;
+			}
+		}
+
+		xhash_table* _M_table = nullptr;
+		size_t _M_index = 0;
+	};
 
 	xhash_table()
 	{
-		_M_size = 1 << 4;
-		initialize_bulk(_M_table, _M_size);	
+		allocate(xhash_group::width);
 	};
 
-	void initialize_bulk(bulk_type& bulk, size_t size)
+	xhash_table(const xhash_table&) = delete;
+	xhash_table& operator=(const xhash_table&) = delete;
+
+	// takes the arrays of other, which is left without storage: it can only be assigned to or destroyed
+	xhash_table(xhash_table&& other) noexcept
+		: _M_ctrl(std::exchange(other._M_ctrl, nullptr)), _M_slots(std::exchange(other._M_slots, nullptr)),
+		  _M_allocator(std::move(other._M_allocator)), _M_hash(std::move(other._M_hash)),
+		  _M_count(std::exchange(other._M_count, 0)), _M_capacity(std::exchange(other._M_capacity, 0)),
+		  _M_growth_left(std::exchange(other._M_growth_left, 0))
 	{
-		bulk.reserve(size);
-		for(int i = 0; i < size; ++i)
+	}
+
+	xhash_table& operator=(xhash_table&& other) noexcept
+	{
+		if(this != &other)
 		{
-			std::list<iterator> empty;
-			bulk.emplace_back(empty);
+			destroy();
+			_M_ctrl = std::exchange(other._M_ctrl, nullptr);
+			_M_slots = std::exchange(other._M_slots, nullptr);
+			_M_allocator = std::move(other._M_allocator);
+			_M_hash = std::move(other._M_hash);
+			_M_count = std::exchange(other._M_count, 0);
+			_M_capacity = std::exchange(other._M_capacity, 0);
+			_M_growth_left = std::exchange(other._M_growth_left, 0);
 		}
+		return *this;
+	}
+
+	~xhash_table()
+	{
+		destroy();
 	}
 
+	// new_size is rounded up to a power of two number of groups
 	void rehash(size_t new_size)
 	{
-		bulk_type bulk;
-		initialize_bulk(bulk, new_size);
-		auto begin = _M_values.begin();
-		auto end = _M_values.end();
+		size_t capacity = xhash_group::width;
+		while(capacity < new_size || capacity * 7 / 8 < _M_count)
+		{
+			capacity <<= 1;
+		}
 
-		while(begin != end)
+		auto old_ctrl = _M_ctrl;
+		auto old_slots = _M_slots;
+		auto old_capacity = _M_capacity;
+		allocate(capacity);
+		for(size_t i = 0; i < old_capacity; ++i)
 		{
-			auto index = find_index(begin.first, new_size);
-			_M_table[index].emplace_back(begin);
-			++begin;
+			if(old_ctrl[i] >= 0)
+			{
+				auto& slot = old_slots[i];
+				auto hash = hash_of(slot.first);
+				auto index = find_insert_slot(hash);
+				construct_at(index, hash, std::move(slot));
+				alloc_traits::destroy(_M_allocator, &slot);
+			}
 		}
+		delete[] old_ctrl;
+		alloc_traits::deallocate(_M_allocator, old_slots, old_capacity);
 	}
 
 	iterator insert(value_type value)
 	{
-		auto index = find_index(value.first, _M_size);
+		return insert_at(hash_of(value.first), value);
+	}
+
+	iterator find(const KeyT& key)
+	{
+		return find_at(hash_of(key), key);
+	}
+
+	iterator erase(KeyT key)
+	{
+		return erase_at(hash_of(key), key);
+	}
+
+	/*
+	   Batched entry points, keys is any contiguous range. A group of keys is
+	   hashed and its control groups prefetched before the first lookup so the
+	   cache misses of the group overlap.
+	*/
+	template<typename Values>
+	size_t insert_batch(const Values& values)
+	{
+		auto before = _M_count;
+		for_each_batch(values, [](const value_type& value) -> const KeyT& { return value.first; },
+			[&](size_t hash, const value_type& value) { insert_at(hash, value); });
+		return _M_count - before;
+	}
+
+	// writes one iterator per key to result, end() for the missing ones
+	template<typename Keys, typename OutputIt>
+	OutputIt find_batch(const Keys& keys, OutputIt result)
+	{
+		for_each_batch(keys, [](const KeyT& key) -> const KeyT& { return key; },
+			[&](size_t hash, const KeyT& key) { *result++ = find_at(hash, key); });
+		return result;
+	}
+
+	template<typename Keys>
+	size_t erase_batch(const Keys& keys)
+	{
+		auto before = _M_count;
+		for_each_batch(keys, [](const KeyT& key) -> const KeyT& { return key; },
+			[&](size_t hash, const KeyT& key) { erase_at(hash, key); });
+		return before - _M_count;
+	}
+
+	iterator begin()
+	{
+		return iterator(this, 0);
+	}
+
+	iterator end()
+	{
+		return iterator(this, _M_capacity);
+	}
+
+	size_t size() const
+	{
+		return _M_count;
+	}
+
+	size_t bucket_count() const
+	{
+		return _M_capacity;
+	}
+
+	void print_list()
+	{
+		for(auto& value : *this)
+		{
+			std::cout << value.first << " " << value.second << std::endl;
+		}
+	}
+	void print_table()
+	{
+		for(size_t index = 0; index < _M_capacity; ++index)
+		{
+			std::cout << index << ":";
+			if(_M_ctrl[index] >= 0)
+			{
+				std::cout << " | " << _M_slots[index].first << "," << _M_slots[index].second;
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	private:
+	iterator insert_at(size_t hash, const value_type& value)
+	{
+		auto found = find_at(hash, value.first);
+		if(found != end())
+		{
+			return found;
+		}
 
-		if(!_M_table[index].empty())
+		auto index = find_insert_slot(hash);
+		if(_M_growth_left == 0 && _M_ctrl[index] == xhash_group::empty)
 		{
+			// full of tombstones: same capacity drops them, otherwise grow
+			rehash(_M_count * 2 < _M_capacity * 7 / 8 ? _M_capacity : _M_capacity * 2);
+			index = find_insert_slot(hash);
+		}
+		construct_at(index, hash, value);
+		return iterator(this, index);
+	}
 
-			for(const auto& pos : _M_table[index])
+	iterator find_at(size_t hash, const KeyT& key)
+	{
+		const auto tag = static_cast<int8_t>(hash & 0x7f);
+		for(size_t group = first_group(hash), step = 0;; group = (group + ++step) & (groups() - 1))
+		{
+			const auto base = group * xhash_group::width;
+			xhash_group ctrl(_M_ctrl + base);
+			for(auto bits = ctrl.match(tag); bits; bits &= bits - 1)
 			{
-				if((pos)->first == value.first)
+				auto index = base + xhash_group::lowest(bits);
+				if(_M_slots[index].first == key)
 				{
-
-					return pos;
+					return iterator(this, index);
 				}
 			}
+			if(ctrl.match_empty())
+			{
+				return end();
+			}
+		}
+	}
 
+	iterator erase_at(size_t hash, const KeyT& key)
+	{
+		auto it = find_at(hash, key);
+		if(it == end())
+		{
+			return it;
 		}
+		const auto index = static_cast<size_t>(&*it - _M_slots);
+		alloc_traits::destroy(_M_allocator, &_M_slots[index]);
+		--_M_count;
 
-		iterator it = _M_values.insert(_M_values.begin(), value);
-		_M_table[index].emplace_back(it);
-		return it;
+		// a group that still has an empty slot never made a probe go past it
+		xhash_group ctrl(_M_ctrl + index / xhash_group::width * xhash_group::width);
+		if(ctrl.match_empty())
+		{
+			_M_ctrl[index] = xhash_group::empty;
+			++_M_growth_left;
+		}
+		else
+		{
+			_M_ctrl[index] = xhash_group::deleted;
+		}
+		return iterator(this, index + 1);
 	}
 
-	iterator erase(KeyT key)
+	// first empty or deleted slot on the probe sequence of hash
+	size_t find_insert_slot(size_t hash)
+	{
+		for(size_t group = first_group(hash), step = 0;; group = (group + ++step) & (groups() - 1))
+		{
+			const auto base = group * xhash_group::width;
+			if(auto bits = xhash_group(_M_ctrl + base).match_empty_or_deleted())
+			{
+				return base + xhash_group::lowest(bits);
+			}
+		}
+	}
+
+	template<typename Value>
+	void construct_at(size_t index, size_t hash, Value&& value)
 	{
-		auto index = find_index(key, _M_size);
-		if(!_M_table[index].empty())
+		alloc_traits::construct(_M_allocator, &_M_slots[index], std::forward<Value>(value));
+		if(_M_ctrl[index] == xhash_group::empty)
 		{
-			auto end = _M_table[index].end();
+			--_M_growth_left;
+		}
+		_M_ctrl[index] = static_cast<int8_t>(hash & 0x7f);
+		++_M_count;
+	}
 
-			for(auto it = _M_table[index].begin() ; it != end; ++it)
+	template<typename Range, typename KeyOf, typename Op>
+	void for_each_batch(const Range& range, KeyOf&& key_of, Op&& op)
+	{
+		const auto first = std::data(range);
+		const size_t count = std::size(range);
+		size_t hash[_M_batch];
+		for(size_t base = 0; base < count; base += _M_batch)
+		{
+			const auto group = std::min(_M_batch, count - base);
+			for(size_t i = 0; i < group; ++i)
+			{
+				hash[i] = hash_of(key_of(first[base + i]));
+				memory::prefetch(_M_ctrl + first_group(hash[i]) * xhash_group::width);
+			}
+			for(size_t i = 0; i < group; ++i)
 			{
-				if((*it)->first == key)
+				op(hash[i], first[base + i]);
+			}
+		}
+	}
+
+	void allocate(size_t capacity)
+	{
+		_M_capacity = capacity;
+		_M_count = 0;
+		_M_growth_left = capacity * 7 / 8;
+		_M_ctrl = new int8_t[capacity];
+		std::memset(_M_ctrl, xhash_group::empty, capacity);
+		_M_slots = alloc_traits::allocate(_M_allocator, capacity);
+	}
+
+	void destroy()
+	{
+		for(size_t i = 0; i < _M_capacity; ++i)
+		{
+			if(_M_ctrl[i] >= 0)
+			{
+				alloc_traits::destroy(_M_allocator, &_M_slots[i]);
+			}
+		}
+		delete[] _M_ctrl;
+		alloc_traits::deallocate(_M_allocator, _M_slots, _M_capacity);
+	}
+
+	size_t groups() const
+	{
+		return _M_capacity / xhash_group::width;
+	}
+
+	// the low 7 bits are the tag, the bits above pick the first group
+	size_t first_group(size_t hash) const
+	{
+		return (hash >> 7) & (groups() - 1);
+	}
+
+	size_t hash_of(const KeyT& key)
+	{
+		uint64_t hash = _M_hash(key);
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ULL;
+		hash ^= hash >> 33;
+		return static_cast<size_t>(hash);
+	}
+
+	int8_t* _M_ctrl = nullptr;
+	value_type* _M_slots = nullptr;
+	allocator_type _M_allocator;
+	HashFuncT _M_hash;
+	size_t _M_count = 0;
+	size_t _M_capacity = 0;
+	size_t _M_growth_left = 0;
+	static constexpr size_t _M_batch = 16;
+
+};
+
+/*
+   Insertion ordered sibling of xhash_table with the compact dict layout:
+   the pairs sit in a dense array in insertion order and the hash index is
+   an open addressed array of offsets into it, 1, 2, 4 or 8 bytes wide as
+   the capacity needs. Iteration is a linear scan of the pairs. An erased
+   pair stays in place, flagged, until the index is rebuilt and the array
+   compacted. Iterators are invalidated by an insert and by a rebuild.
+*/
+template<typename KeyT, typename ValueT, typename HashFuncT = std::hash<KeyT>>
+struct ordered_xhash_table {
+	using value_type = std::pair<KeyT, ValueT>;
+
+	struct iterator
+	{
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = typename ordered_xhash_table::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = value_type*;
+		using reference = value_type&;
+
+		iterator() = default;
+
+		iterator(ordered_xhash_table* table, size_t index) : _M_table(table), _M_index(index)
+		{
+			skip();
+		}
+
+		reference operator*() const
+		{
+			return _M_table->_M_entries[_M_index];
+		}
+
+		pointer operator->() const
+		{
+			return &_M_table->_M_entries[_M_index];
+		}
+
+		iterator& operator++()
+		{
+			++_M_index;
+			skip();
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			auto ret = *this;
+			++*this;
+			return ret;
+		}
+
+		bool operator==(const iterator& rhs) const
+		{
+			return _M_index == rhs._M_index;
+		}
+
+		bool operator!=(const iterator& rhs) const
+		{
+			return _M_index != rhs._M_index;
+		}
+
+		private:
+		void skip()
+		{
+			while(_M_index < _M_table->_M_entries.size() && _M_table->_M_erased[_M_index])
+			{
+				++_M_index;
+			}
+		}
+
+		ordered_xhash_table* _M_table = nullptr;
+		size_t _M_index = 0;
+	};
+
+	ordered_xhash_table()
+	{
+		rebuild();
+	}
+
+	ordered_xhash_table(const ordered_xhash_table&) = default;
+	ordered_xhash_table& operator=(const ordered_xhash_table&) = default;
+
+	// other is left without storage, it can only be assigned to or destroyed
+	ordered_xhash_table(ordered_xhash_table&& other) noexcept
+		: _M_entries(std::move(other._M_entries)), _M_erased(std::move(other._M_erased)),
+		  _M_index(std::move(other._M_index)), _M_hash(std::move(other._M_hash)),
+		  _M_count(std::exchange(other._M_count, 0)), _M_capacity(std::exchange(other._M_capacity, 0)),
+		  _M_width(std::exchange(other._M_width, 1))
+	{
+	}
+
+	ordered_xhash_table& operator=(ordered_xhash_table&& other) noexcept
+	{
+		if(this != &other)
+		{
+			_M_entries = std::move(other._M_entries);
+			_M_erased = std::move(other._M_erased);
+			_M_index = std::move(other._M_index);
+			_M_hash = std::move(other._M_hash);
+			_M_count = std::exchange(other._M_count, 0);
+			_M_capacity = std::exchange(other._M_capacity, 0);
+			_M_width = std::exchange(other._M_width, 1);
+		}
+		return *this;
+	}
+
+	// an existing key keeps its value and its place in the order
+	iterator insert(value_type value)
+	{
+		const auto hash = hash_of(value.first);
+		auto slot = find_slot(hash, value.first);
+		if(slot._M_found)
+		{
+			return iterator(this, offset(slot._M_index) - 1);
+		}
+		if((_M_entries.size() + 1) * 3 > _M_capacity * 2)
+		{
+			rebuild();
+			slot = find_slot(hash, value.first);
+		}
+		set_offset(slot._M_index, _M_entries.size() + 1);
+		_M_entries.push_back(std::move(value));
+		_M_erased.push_back(false);
+		++_M_count;
+		return iterator(this, _M_entries.size() - 1);
+	}
+
+	iterator find(const KeyT& key)
+	{
+		const auto slot = find_slot(hash_of(key), key);
+		return slot._M_found ? iterator(this, offset(slot._M_index) - 1) : end();
+	}
+
+	// returns the element that followed key in the order
+	iterator erase(const KeyT& key)
+	{
+		const auto slot = find_slot(hash_of(key), key);
+		if(!slot._M_found)
+		{
+			return end();
+		}
+		const auto index = offset(slot._M_index) - 1;
+		set_offset(slot._M_index, deleted());
+		_M_erased[index] = true;
+		--_M_count;
+		return iterator(this, index + 1);
+	}
+
+	iterator begin()
+	{
+		return iterator(this, 0);
+	}
+
+	iterator end()
+	{
+		return iterator(this, _M_entries.size());
+	}
+
+	size_t size() const
+	{
+		return _M_count;
+	}
+
+	size_t bucket_count() const
+	{
+		return _M_capacity;
+	}
+
+	// bytes of one offset of the index
+	size_t offset_width() const
+	{
+		return _M_width;
+	}
+
+	private:
+	struct slot_position
+	{
+		size_t _M_index;
+		bool _M_found;
+	};
+
+	// index slot of key, or the slot an insert of key would take
+	slot_position find_slot(size_t hash, const KeyT& key) const
+	{
+		const auto mask = _M_capacity - 1;
+		size_t reuse = _M_capacity;
+		for(size_t index = hash & mask;; index = (index + 1) & mask)
+		{
+			const auto at = offset(index);
+			if(at == 0)
+			{
+				return {reuse != _M_capacity ? reuse : index, false};
+			}
+			if(at == deleted())
+			{
+				reuse = reuse != _M_capacity ? reuse : index;
+			}
+			else if(_M_entries[at - 1].first == key)
+			{
+				return {index, true};
+			}
+		}
+	}
+
+	// 0 is an empty slot, deleted() an erased one, any other value the position in the pairs plus one
+	size_t offset(size_t index) const
+	{
+		switch(_M_width)
+		{
+		case 1:
+			return _M_index[index];
+		case 2:
+			return load<uint16_t>(index);
+		case 4:
+			return load<uint32_t>(index);
+		default:
+			return static_cast<size_t>(load<uint64_t>(index));
+		}
+	}
+
+	void set_offset(size_t index, size_t value)
+	{
+		switch(_M_width)
+		{
+		case 1:
+			_M_index[index] = static_cast<uint8_t>(value);
+			break;
+		case 2:
+			store(index, static_cast<uint16_t>(value));
+			break;
+		case 4:
+			store(index, static_cast<uint32_t>(value));
+			break;
+		default:
+			store(index, static_cast<uint64_t>(value));
+		}
+	}
+
+	template<typename T>
+	T load(size_t index) const
+	{
+		T ret;
+		std::memcpy(&ret, _M_index.data() + index * sizeof(T), sizeof(T));
+		return ret;
+	}
+
+	template<typename T>
+	void store(size_t index, T value)
+	{
+		std::memcpy(_M_index.data() + index * sizeof(T), &value, sizeof(T));
+	}
+
+	size_t deleted() const
+	{
+		return _M_width == 8 ? ~size_t(0) : (size_t(1) << (_M_width * 8)) - 1;
+	}
+
+	// compacts the pairs and sizes the index for three times the live ones
+	void rebuild()
+	{
+		if(_M_count != _M_entries.size())
+		{
+			size_t live = 0;
+			for(size_t i = 0; i < _M_entries.size(); ++i)
+			{
+				if(!_M_erased[i])
 				{
-					auto ret = _M_values.erase(*it);
-					_M_table[index].erase(it);
-					return ret;
+					if(live != i)
+					{
+						_M_entries[live] = std::move(_M_entries[i]);
+					}
+					++live;
 				}
 			}
+			_M_entries.erase(_M_entries.begin() + live, _M_entries.end());
+			_M_erased.assign(live, false);
+		}
+		_M_capacity = 8;
+		while(_M_capacity < (_M_count + 1) * 3)
+		{
+			_M_capacity <<= 1;
+		}
+		// the largest offset is the capacity, deleted() must stay above it
+		_M_width = _M_capacity < 0xff ? 1 : _M_capacity < 0xffff ? 2 : _M_capacity < 0xffffffffULL ? 4 : 8;
+		_M_index.assign(_M_capacity * _M_width, 0);
+		for(size_t i = 0; i < _M_entries.size(); ++i)
+		{
+			set_offset(find_slot(hash_of(_M_entries[i].first), _M_entries[i].first)._M_index, i + 1);
 		}
-		return _M_values.end();
 	}
 
-	void print_list()
+	size_t hash_of(const KeyT& key) const
+	{
+		uint64_t hash = _M_hash(key);
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ULL;
+		hash ^= hash >> 33;
+		return static_cast<size_t>(hash);
+	}
+
+	std::vector<value_type> _M_entries;
+	std::vector<bool> _M_erased;
+	std::vector<uint8_t> _M_index;
+	HashFuncT _M_hash;
+	size_t _M_count = 0;
+	size_t _M_capacity = 0;
+	size_t _M_width = 1;
+};
+
+/*
+   Lookup only map over a static key set. The keys are placed by a minimal
+   perfect hash (BBHash): level l is a bit array of about gamma times the
+   keys left, a key whose level hash lands alone sets its bit and the keys
+   that collide go down to the next level. The slot of a key is the rank of
+   its bit over all levels, so the pairs sit in a dense array with no empty
+   slot and a lookup reads one slot. The default gamma 1 costs about 3.4
+   bits per key for the bits and the rank words, gamma 2 about 4.2 bits per
+   key but fewer levels to walk, so faster misses and builds. The few keys
+   left after the last level go to the end of the slots and are searched
+   linearly.
+*/
+template<typename KeyT, typename ValueT, typename HashFuncT = std::hash<KeyT>>
+struct perfect_hash_map {
+	using value_type = std::pair<KeyT, ValueT>;
+
+	// a key that repeats keeps its first value
+	template<typename ForwardIt>
+	perfect_hash_map(ForwardIt first, ForwardIt last, double gamma = 1.0)
 	{
-		for(auto& value : _M_values)
+		std::vector<value_type> values;
+		xhash_table<KeyT, size_t, HashFuncT> seen;
+		for(auto it = first; it != last; ++it)
 		{
-			std::cout << value.first << " " << value.second << std::endl;
+			if(seen.insert({it->first, values.size()})->second == values.size())
+			{
+				values.emplace_back(it->first, it->second);
+			}
 		}
+		build(std::move(values), std::max(gamma, 1.0));
 	}
-	void print_table()
+
+	// the value of key, nullptr when key is not in the set
+	const ValueT* find(const KeyT& key) const
 	{
-		auto index = 0;
-		for(auto& row : _M_table)
+		const uint64_t hash = _M_hash(key);
+		for(size_t level = 0, offset = 0; level < _M_levels.size(); offset += _M_levels[level++])
 		{
-			std::cout << index++ << ":";
-			for(auto& value : row)
+			const auto bit = offset + reduce(level_hash(hash, level), _M_levels[level]);
+			if(word_of(bit) >> (bit % 64) & 1)
 			{
-				std::cout << " | " << value->first << "," << value->second;
+				auto& slot = _M_slots[rank(bit)];
+				return slot.first == key ? &slot.second : nullptr;
+			}
+		}
+		for(size_t index = _M_slots.size() - _M_spilled; index < _M_slots.size(); ++index)
+		{
+			if(_M_slots[index].first == key)
+			{
+				return &_M_slots[index].second;
 			}
-			std::cout << std::endl;
 		}
+		return nullptr;
+	}
+
+	size_t size() const
+	{
+		return _M_slots.size();
+	}
+
+	// memory of the hash function, the slots are not counted
+	double bits_per_key() const
+	{
+		return _M_slots.empty() ? 0 : 64.0 * _M_blocks.size() / _M_slots.size();
 	}
 
 	private:
-	size_t find_index(const KeyT& value, size_t size)
+	static constexpr size_t _M_max_levels = 32;
+	// a block is two rank words followed by 8 words of bits, the rank of a bit is read from its own block
+	static constexpr size_t _M_block_words = 8;
+
+	void build(std::vector<value_type> values, double gamma)
 	{
-		auto hash = _M_hash(value);
-		return hash % size;	
+		const auto count = values.size();
+		std::vector<uint64_t> hash(count);
+		std::vector<size_t> left(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			hash[i] = _M_hash(values[i].first);
+			left[i] = i;
+		}
+
+		// bit of every placed key, the keys of a level are final once its collisions are cleared
+		std::vector<uint64_t> level_bits;
+		std::vector<size_t> position(count);
+		size_t offset = 0;
+		for(size_t level = 0; level < _M_max_levels && !left.empty(); ++level)
+		{
+			const auto bits = (static_cast<size_t>(left.size() * gamma) + 63) / 64 * 64;
+			std::vector<uint64_t> taken(bits / 64), collided(bits / 64);
+			for(auto i : left)
+			{
+				const auto bit = reduce(level_hash(hash[i], level), bits);
+				auto& word = taken[bit / 64];
+				const auto mask = uint64_t(1) << (bit % 64);
+				collided[bit / 64] |= word & mask;
+				word |= mask;
+			}
+			std::vector<size_t> next;
+			for(auto i : left)
+			{
+				const auto bit = reduce(level_hash(hash[i], level), bits);
+				if(collided[bit / 64] >> (bit % 64) & 1)
+				{
+					next.push_back(i);
+				}
+				else
+				{
+					position[i] = offset + bit;
+				}
+			}
+			for(size_t word = 0; word < taken.size(); ++word)
+			{
+				level_bits.push_back(taken[word] & ~collided[word]);
+			}
+			_M_levels.push_back(bits);
+			offset += bits;
+			left.swap(next);
+		}
+
+		uint64_t ranked = 0;
+		_M_blocks.resize((level_bits.size() + _M_block_words - 1) / _M_block_words * (_M_block_words + 2));
+		for(size_t word = 0; word < level_bits.size(); ++word)
+		{
+			auto block = &_M_blocks[word / _M_block_words * (_M_block_words + 2)];
+			const auto sub = word % _M_block_words;
+			if(sub == 0)
+			{
+				block[0] = ranked;
+			}
+			else
+			{
+				block[1] |= (ranked - block[0]) << (63 - 9 * sub);
+			}
+			block[2 + sub] = level_bits[word];
+			ranked += popcount(level_bits[word]);
+		}
+
+		std::vector<bool> spilled(count);
+		for(auto i : left)
+		{
+			spilled[i] = true;
+		}
+		_M_slots.reserve(count);
+		_M_slots.resize(ranked, values.empty() ? value_type() : values[0]);
+		for(size_t i = 0; i < count; ++i)
+		{
+			if(!spilled[i])
+			{
+				_M_slots[rank(position[i])] = std::move(values[i]);
+			}
+		}
+		for(auto i : left)
+		{
+			_M_slots.push_back(std::move(values[i]));
+		}
+		_M_spilled = left.size();
 	}
 
-	list_type _M_values;
-	bulk_type _M_table;
-	HashFuncT _M_hash;
-	size_t _M_count;
-	size_t _M_size;
+	const uint64_t* block_of(size_t bit) const
+	{
+		return &_M_blocks[bit / 64 / _M_block_words * (_M_block_words + 2)];
+	}
+
+	uint64_t word_of(size_t bit) const
+	{
+		return block_of(bit)[2 + bit / 64 % _M_block_words];
+	}
+
+	// set bits before bit, rank9 (Vigna): word 0 of a block counts the bits of the blocks before,
+	// word 1 packs the 9 bit counts of the bit words 1..7 of the block, bit word 0 reads bit 63
+	size_t rank(size_t bit) const
+	{
+		const auto block = block_of(bit);
+		const auto sub = (block[1] >> (63 - 9 * (bit / 64 % _M_block_words))) & 0x1ff;
+		return block[0] + sub + popcount(block[2 + bit / 64 % _M_block_words] & ((uint64_t(1) << (bit % 64)) - 1));
+	}
+
+	static size_t popcount(uint64_t bits)
+	{
+#if defined(__POPCNT__)
+		return static_cast<size_t>(__builtin_popcountll(bits));
+#else
+		// without popcnt the builtin is a library call, the bit slicing stays inline
+		bits -= (bits >> 1) & 0x5555555555555555ULL;
+		bits = (bits & 0x3333333333333333ULL) + ((bits >> 2) & 0x3333333333333333ULL);
+		bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+		return static_cast<size_t>((bits * 0x0101010101010101ULL) >> 56);
+#endif
+	}
 
+	static uint64_t level_hash(uint64_t hash, size_t level)
+	{
+		hash += (level + 1) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	// maps hash onto [0, size) without a division
+	static size_t reduce(uint64_t hash, size_t size)
+	{
+#if defined(__SIZEOF_INT128__)
+		return static_cast<size_t>((static_cast<unsigned __int128>(hash) * size) >> 64);
+#else
+		return static_cast<size_t>(hash % size);
+#endif
+	}
+
+	std::vector<value_type> _M_slots;
+	std::vector<uint64_t> _M_blocks;
+	std::vector<size_t> _M_levels;
+	size_t _M_spilled = 0;
+	HashFuncT _M_hash;
 };
 
-#endif 
+#endif
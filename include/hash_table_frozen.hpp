@@ -0,0 +1,374 @@
+#ifndef __HASH_TABLE_FROZEN__
+#define __HASH_TABLE_FROZEN__
+#include "hash_table_lock_free.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <optional>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#define LF_FROZEN_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace lf
+{
+
+/*
+   Header of a frozen table image. Every position is an offset from the
+   start of the image, so a mapping works at any address. The buckets are
+   bucket_count + 1 offsets into the entries, bucket b holds the entries
+   [buckets[b], buckets[b + 1]). The magic is written in native byte order,
+   an image from a host of the other endianness does not validate.
+*/
+struct frozen_header
+{
+    constexpr static std::uint64_t MAGIC = 0x315a52464c545346ULL;
+
+    std::uint64_t _M_magic;
+    std::uint32_t _M_key_size;
+    std::uint32_t _M_value_size;
+    std::uint64_t _M_entry_size;
+    std::uint64_t _M_size;
+    std::uint64_t _M_bucket_count;
+    std::uint64_t _M_buckets;
+    std::uint64_t _M_entries;
+    std::uint64_t _M_bytes;
+};
+
+/*
+   Read only table over a frozen image, built from any range of pairs or
+   from an lf::HashTable and reopened with mmap: opening validates the
+   header and maps the file, there is no parsing and no allocation, and the
+   page cache is shared by every process mapping the same file.
+   A key goes to bucket mix_hash(hash) & (bucket_count - 1), the index of
+   lf::HashTable, with one bucket per key rounded up to a power of two.
+   HashFunc must hash the same way in the writer and in the reader.
+*/
+template <typename Key, typename Value, typename HashFunc = std::hash<Key>, typename Compare = std::equal_to<Key>>
+class FrozenHashTable
+{
+  public:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "frozen images store keys and values as raw bytes");
+
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<Key, Value>;
+    using size_type = std::size_t;
+
+    struct entry
+    {
+        Key _M_key;
+        Value _M_value;
+    };
+
+    FrozenHashTable() = default;
+
+    // view over an image that outlives the table, an image that does not validate gives an empty table
+    FrozenHashTable(const void *image, size_type bytes)
+    {
+        attach(image, bytes);
+    }
+
+    FrozenHashTable(FrozenHashTable &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    FrozenHashTable &operator=(FrozenHashTable &&other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            _M_header = std::exchange(other._M_header, nullptr);
+            _M_buckets = std::exchange(other._M_buckets, nullptr);
+            _M_entries = std::exchange(other._M_entries, nullptr);
+            _M_mapping = std::exchange(other._M_mapping, nullptr);
+            _M_mapped = std::exchange(other._M_mapped, 0);
+            _M_owned = std::move(other._M_owned);
+        }
+        return *this;
+    }
+
+    FrozenHashTable(const FrozenHashTable &) = delete;
+    FrozenHashTable &operator=(const FrozenHashTable &) = delete;
+
+    ~FrozenHashTable()
+    {
+        unmap();
+    }
+
+    // image of the pairs in [first, last), a key that repeats keeps its first value
+    template <typename ForwardIt> static std::vector<char> build(ForwardIt first, ForwardIt last)
+    {
+        HashFunc hasher;
+        Compare compare;
+        std::vector<std::uint64_t> hash;
+        std::vector<entry> values;
+        for (auto it = first; it != last; ++it)
+        {
+            entry value;
+            std::memset(&value, 0, sizeof(value));
+            value._M_key = it->first;
+            value._M_value = it->second;
+            values.push_back(value);
+            hash.push_back(mix_hash(hasher(it->first)));
+        }
+
+        // a repeated key lands in the bucket of its first pair, which the stable sort puts first
+        std::vector<std::uint64_t> offsets;
+        auto order = sort_by_bucket(hash, {}, bucket_count_for(values.size()), offsets);
+        std::vector<size_type> kept;
+        kept.reserve(values.size());
+        for (size_type b = 0; b + 1 < offsets.size(); ++b)
+        {
+            const auto begin = kept.size();
+            for (auto i = offsets[b]; i < offsets[b + 1]; ++i)
+            {
+                const auto &value = values[order[i]];
+                const bool repeat = std::any_of(kept.begin() + begin, kept.end(), [&](size_type k) {
+                    return hash[k] == hash[order[i]] && compare(values[k]._M_key, value._M_key);
+                });
+                if (!repeat)
+                {
+                    kept.push_back(order[i]);
+                }
+            }
+        }
+        std::sort(kept.begin(), kept.end());
+
+        const auto count = kept.size();
+        const auto bucket_count = bucket_count_for(count);
+        order = sort_by_bucket(hash, kept, bucket_count, offsets);
+
+        frozen_header header{};
+        header._M_magic = frozen_header::MAGIC;
+        header._M_key_size = sizeof(Key);
+        header._M_value_size = sizeof(Value);
+        header._M_entry_size = sizeof(entry);
+        header._M_size = count;
+        header._M_bucket_count = bucket_count;
+        header._M_buckets = align(sizeof(frozen_header), alignof(std::uint64_t));
+        header._M_entries = align(header._M_buckets + (bucket_count + 1) * sizeof(std::uint64_t), alignof(entry));
+        header._M_bytes = header._M_entries + count * sizeof(entry);
+
+        std::vector<char> image(header._M_bytes);
+        std::memcpy(image.data(), &header, sizeof(header));
+        std::memcpy(image.data() + header._M_buckets, offsets.data(), offsets.size() * sizeof(std::uint64_t));
+        auto entries = image.data() + header._M_entries;
+        for (size_type i = 0; i < count; ++i)
+        {
+            std::memcpy(entries + i * sizeof(entry), &values[order[i]], sizeof(entry));
+        }
+        return image;
+    }
+
+    // image of the keys of a lock free table, taken with a full scan, a key the scan reports twice is kept once
+    template <typename Table> static std::vector<char> freeze(Table &table)
+    {
+        std::vector<value_type> values;
+        values.reserve(table.size());
+        std::uint64_t cursor = 0;
+        do
+        {
+            cursor = table.scan(cursor, [&](const Key &key, const Value &value) { values.push_back({key, value}); });
+        } while (cursor != 0);
+        return build(values.begin(), values.end());
+    }
+
+    static bool write(const char *path, const std::vector<char> &image)
+    {
+        auto file = std::fopen(path, "wb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        const bool written = std::fwrite(image.data(), 1, image.size(), file) == image.size();
+        return std::fclose(file) == 0 && written;
+    }
+
+    // maps the image at path read only, a missing or invalid file gives an empty table
+    static FrozenHashTable open(const char *path)
+    {
+        FrozenHashTable table;
+#ifdef LF_FROZEN_MMAP
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return table;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            const auto bytes = static_cast<size_type>(info.st_size);
+            auto mapping = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                table._M_mapping = mapping;
+                table._M_mapped = bytes;
+                table.attach(mapping, bytes);
+            }
+        }
+        ::close(fd);
+#else
+        // no mmap, the image is read into memory
+        auto file = std::fopen(path, "rb");
+        if (file == nullptr)
+        {
+            return table;
+        }
+        char buffer[1 << 16];
+        size_type read;
+        while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+        {
+            table._M_owned.insert(table._M_owned.end(), buffer, buffer + read);
+        }
+        std::fclose(file);
+        table.attach(table._M_owned.data(), table._M_owned.size());
+#endif
+        if (!table.valid())
+        {
+            table.unmap();
+        }
+        return table;
+    }
+
+    bool valid() const
+    {
+        return _M_header != nullptr;
+    }
+
+    size_type size() const
+    {
+        return _M_header ? _M_header->_M_size : 0;
+    }
+
+    size_type bucket_count() const
+    {
+        return _M_header ? _M_header->_M_bucket_count : 0;
+    }
+
+    std::optional<Value> find(const Key &key) const
+    {
+        if (_M_header == nullptr)
+        {
+            return std::nullopt;
+        }
+        const auto bucket = mix_hash(_M_hasher(key)) & (_M_header->_M_bucket_count - 1);
+        // clamped so a damaged bucket offset cannot read past the entries
+        const auto last = std::min<std::uint64_t>(_M_buckets[bucket + 1], _M_header->_M_size);
+        for (auto i = _M_buckets[bucket]; i < last; ++i)
+        {
+            if (_M_compare(_M_entries[i]._M_key, key))
+            {
+                return _M_entries[i]._M_value;
+            }
+        }
+        return std::nullopt;
+    }
+
+  private:
+    static std::uint64_t align(std::uint64_t offset, std::uint64_t alignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // one bucket per key, rounded up to a power of two
+    static size_type bucket_count_for(size_type count)
+    {
+        size_type bucket_count = 1;
+        while (bucket_count < count)
+        {
+            bucket_count <<= 1;
+        }
+        return bucket_count;
+    }
+
+    /*
+       Stable counting sort of the pairs picked (every pair when picked is
+       empty) by bucket. Returns the pair indices in bucket order, offsets
+       gets the bucket_count + 1 bucket offsets into it.
+    */
+    static std::vector<size_type> sort_by_bucket(const std::vector<std::uint64_t> &hash,
+                                                 const std::vector<size_type> &picked, size_type bucket_count,
+                                                 std::vector<std::uint64_t> &offsets)
+    {
+        const auto count = picked.empty() ? hash.size() : picked.size();
+        auto pair = [&](size_type i) { return picked.empty() ? i : picked[i]; };
+        offsets.assign(bucket_count + 1, 0);
+        for (size_type i = 0; i < count; ++i)
+        {
+            ++offsets[(hash[pair(i)] & (bucket_count - 1)) + 1];
+        }
+        for (size_type b = 0; b < bucket_count; ++b)
+        {
+            offsets[b + 1] += offsets[b];
+        }
+        std::vector<std::uint64_t> cursor(offsets.begin(), offsets.end() - 1);
+        std::vector<size_type> order(count);
+        for (size_type i = 0; i < count; ++i)
+        {
+            order[cursor[hash[pair(i)] & (bucket_count - 1)]++] = pair(i);
+        }
+        return order;
+    }
+
+    // checks the header and the bounds of the image once
+    void attach(const void *image, size_type bytes)
+    {
+        auto base = static_cast<const char *>(image);
+        if (bytes < sizeof(frozen_header) || reinterpret_cast<std::uintptr_t>(base) % alignof(std::uint64_t))
+        {
+            return;
+        }
+        auto header = reinterpret_cast<const frozen_header *>(base);
+        const auto count = header->_M_bucket_count;
+        if (header->_M_magic != frozen_header::MAGIC || header->_M_key_size != sizeof(Key) ||
+            header->_M_value_size != sizeof(Value) || header->_M_entry_size != sizeof(entry) ||
+            header->_M_bytes > bytes || count == 0 || (count & (count - 1)) != 0 ||
+            header->_M_buckets % alignof(std::uint64_t) || header->_M_entries % alignof(entry) ||
+            header->_M_buckets + (count + 1) * sizeof(std::uint64_t) > header->_M_entries ||
+            header->_M_entries + header->_M_size * sizeof(entry) > header->_M_bytes)
+        {
+            return;
+        }
+        auto buckets = reinterpret_cast<const std::uint64_t *>(base + header->_M_buckets);
+        if (buckets[0] != 0 || buckets[count] != header->_M_size)
+        {
+            return;
+        }
+        _M_header = header;
+        _M_buckets = buckets;
+        _M_entries = reinterpret_cast<const entry *>(base + header->_M_entries);
+    }
+
+    void unmap()
+    {
+#ifdef LF_FROZEN_MMAP
+        if (_M_mapping)
+        {
+            ::munmap(_M_mapping, _M_mapped);
+        }
+#endif
+        _M_header = nullptr;
+        _M_buckets = nullptr;
+        _M_entries = nullptr;
+        _M_mapping = nullptr;
+        _M_mapped = 0;
+    }
+
+    const frozen_header *_M_header = nullptr;
+    const std::uint64_t *_M_buckets = nullptr;
+    const entry *_M_entries = nullptr;
+    void *_M_mapping = nullptr;
+    size_type _M_mapped = 0;
+    std::vector<char> _M_owned;
+    HashFunc _M_hasher;
+    Compare _M_compare;
+};
+
+} // namespace lf
+#endif
@@ -1,8 +1,21 @@
 #ifndef __HASH_TABLE_LOCK_FREE__
 #define __HASH_TABLE_LOCK_FREE__
 #include <utility>
+#include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iterator>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include "memory.hpp"
 
 namespace lf
@@ -18,6 +31,83 @@ namespace lf
       em paralelo a faz beg->a to beg->b
 */
 
+// destructive interference size of the targets we build for, hot atomics of different threads are kept apart
+constexpr std::size_t cache_line_size = 64;
+
+// small index handed to every thread on first use, spreads threads over the cells of sharded_counter
+inline std::size_t thread_slot()
+{
+    static std::atomic<std::size_t> next = 0;
+    thread_local const std::size_t slot = next.fetch_add(1);
+    return slot;
+}
+
+/*
+   Counter updated by many threads. Each thread adds to its own cache line
+   cell and the cells are summed when load() is called. A cell folds its
+   pending delta into the shared total every SYNC units, so approx() reads
+   one shared word plus the cell of the caller and is off by less than
+   (Cells - 1) * SYNC. load() is exact once the writers are quiescent.
+*/
+template <typename T, std::size_t Cells = 16> class sharded_counter
+{
+  public:
+    using value_type = T;
+    using signed_type = std::make_signed_t<T>;
+
+    sharded_counter() = default;
+    sharded_counter(const sharded_counter &) = delete;
+    sharded_counter &operator=(const sharded_counter &) = delete;
+
+    void add(signed_type delta)
+    {
+        auto &cell = _M_cells[thread_slot() % Cells];
+        const auto pending = cell._M_pending.fetch_add(delta, std::memory_order_relaxed) + delta;
+        if (pending >= SYNC || pending <= -SYNC)
+        {
+            _M_total.fetch_add(cell._M_pending.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+    void operator++()
+    {
+        add(1);
+    }
+
+    void operator--()
+    {
+        add(-1);
+    }
+
+    value_type load() const
+    {
+        auto sum = _M_total.load();
+        for (const auto &cell : _M_cells)
+        {
+            sum += cell._M_pending.load();
+        }
+        return static_cast<value_type>(std::max<signed_type>(sum, 0));
+    }
+
+    value_type approx() const
+    {
+        auto sum = _M_total.load(std::memory_order_relaxed) +
+                   _M_cells[thread_slot() % Cells]._M_pending.load(std::memory_order_relaxed);
+        return static_cast<value_type>(std::max<signed_type>(sum, 0));
+    }
+
+  private:
+    constexpr static signed_type SYNC = 32;
+
+    struct alignas(cache_line_size) cell
+    {
+        std::atomic<signed_type> _M_pending = 0;
+    };
+
+    alignas(cache_line_size) std::atomic<signed_type> _M_total = 0;
+    cell _M_cells[Cells];
+};
+
 template <typename NodeT> struct forward_iterator_list
 {
     using iterator_category = std::forward_iterator_tag;
@@ -40,10 +130,10 @@ template <typename NodeT> struct forward_iterator_list
 
     forward_iterator_list<NodeT> &operator++()
     {
-        _M_data = _M_data->_M_next;
+        _M_data = _M_data->next();
         while ((!_M_data->_M_nil) && _M_data->_M_deleted)
         {
-            _M_data = _M_data->_M_next;
+            _M_data = _M_data->next();
         }
         return *this;
     }
@@ -83,12 +173,49 @@ template <typename T> struct forward_node
     forward_node() = default;
 
     value_type _M_value;
-    forward_node<T> *_M_next;
+    // sort key of the ordered chains, written before the node is linked
+    std::uint64_t _M_order = 0;
+    std::atomic<forward_node<T> *> _M_next = nullptr;
     forward_node<T> *_M_previous;
     std::atomic<bool> _M_deleted = false;
     bool _M_ready = false;
     bool _M_nil = false;
 
+    /*
+       An erased node marks its next pointer before being unlinked, after that
+       nobody can link a node behind it and only the thread that swings the
+       predecessor past it retires the node to the epoch domain.
+    */
+    constexpr static std::uintptr_t MARKED = 0x1;
+
+    static forward_node<T> *unmarked(forward_node<T> *ptr)
+    {
+        return reinterpret_cast<forward_node<T> *>(reinterpret_cast<std::uintptr_t>(ptr) & ~MARKED);
+    }
+
+    static bool is_marked(forward_node<T> *ptr)
+    {
+        return (reinterpret_cast<std::uintptr_t>(ptr) & MARKED) != 0;
+    }
+
+    static forward_node<T> *marked(forward_node<T> *ptr)
+    {
+        return reinterpret_cast<forward_node<T> *>(reinterpret_cast<std::uintptr_t>(ptr) | MARKED);
+    }
+
+    forward_node<T> *next() const
+    {
+        return unmarked(_M_next.load());
+    }
+
+    void mark()
+    {
+        auto next = _M_next.load();
+        while (!is_marked(next) && !_M_next.compare_exchange_weak(next, marked(next)))
+        {
+        }
+    }
+
     template <typename Allocator> static forward_node<T> *allocate(Allocator &allocator)
     {
         auto node = std::allocator_traits<Allocator>::allocate(allocator, 1);
@@ -101,8 +228,96 @@ template <typename T> struct forward_node
         std::allocator_traits<Allocator>::destroy(allocator, ptr);
         std::allocator_traits<Allocator>::deallocate(allocator, ptr, 1);
     }
+
+    /*
+       The node goes back through allocator once no thread can hold it. An
+       allocator that is not always equal travels with the node as a copy,
+       so the node returns to the same arena or pool.
+    */
+    template <typename Allocator> static void retire(const Allocator &allocator, forward_node<T> *ptr)
+    {
+        if constexpr (std::allocator_traits<Allocator>::is_always_equal::value &&
+                      std::is_default_constructible<Allocator>::value)
+        {
+            (void)allocator;
+            memory::EpochDomain::instance().retire(ptr, [](void *p) {
+                Allocator allocator;
+                deallocate(allocator, static_cast<forward_node<T> *>(p));
+            });
+        }
+        else
+        {
+            struct retired
+            {
+                forward_node<T> *_M_node;
+                Allocator _M_allocator;
+            };
+            memory::EpochDomain::instance().retire(new retired{ptr, allocator}, [](void *p) {
+                auto record = static_cast<retired *>(p);
+                deallocate(record->_M_allocator, record->_M_node);
+                delete record;
+            });
+        }
+    }
+
+    // end node shared by every set, a bucket array is built without allocating a node per bucket
+    static forward_node<T> *nil()
+    {
+        struct sentinel
+        {
+            sentinel()
+            {
+                node._M_next = &node;
+                node._M_nil = true;
+            }
+            forward_node<T> node;
+        };
+        static sentinel end;
+        return &end.node;
+    }
 };
 
+/*
+   Walks the chain from head and unlinks every marked node, the caller must
+   be inside an epoch guard. Gives up when head carries tag bits, a frozen
+   set is left to the resize.
+*/
+template <typename Allocator, typename Node>
+void unlink_marked(const Allocator &allocator, std::atomic<Node *> &head, Node *last)
+{
+    bool restart = true;
+    while (restart)
+    {
+        restart = false;
+        std::atomic<Node *> *prev = &head;
+        auto curr = prev->load();
+        if ((reinterpret_cast<std::uintptr_t>(curr) & (alignof(Node) - 1)) != 0)
+        {
+            return;
+        }
+        while (curr != last)
+        {
+            auto next = curr->_M_next.load();
+            if (!Node::is_marked(next))
+            {
+                prev = &curr->_M_next;
+                curr = next;
+            }
+            else if (prev->compare_exchange_strong(curr, Node::unmarked(next)))
+            {
+                Node::retire(allocator, curr);
+                curr = Node::unmarked(next);
+            }
+            else
+            {
+                // the predecessor changed or is being unlinked too
+                restart = true;
+                break;
+            }
+        }
+    }
+}
+
 template <typename T, typename Allocator = std::allocator<T>> class list
 {
   public:
@@ -113,7 +328,11 @@ template <typename T, typename Allocator = std::allocator<T>> class list
     using allocator_node = typename alloc_traits::template rebind_alloc<node_type>;
     using iterator = forward_iterator_list<node_type>;
 
-    list()
+    list() : list(Allocator())
+    {
+    }
+
+    explicit list(const Allocator &allocator) : _M_allocator_node(allocator)
     {
         _M_end.store(node_type::allocate(_M_allocator_node));
         _M_begin.store(_M_end.load());
@@ -121,6 +340,7 @@ template <typename T, typename Allocator = std::allocator<T>> class list
 
     iterator append(const value_type& value)
     {
+        memory::EpochGuard guard;
         auto nnode_ = node_type::allocate(_M_allocator_node); 
         nnode_->_M_value = value;
 
@@ -133,10 +353,17 @@ template <typename T, typename Allocator = std::allocator<T>> class list
         return iterator(nnode_);
     }
 
+    // iterators shared with other threads are only safe inside a memory::EpochGuard
     void erase(iterator& it)
     {
+        memory::EpochGuard guard;
         node_type* node_ = it.get_unsafe_pointer();
-        node_->_M_deleted.store(true);
+        bool expected = false;
+        if (node_->_M_deleted.compare_exchange_strong(expected, true))
+        {
+            node_->mark();
+            unlink_marked(_M_allocator_node, _M_begin, _M_end.load());
+        }
     }
 
     iterator begin()
@@ -156,7 +383,7 @@ template <typename T, typename Allocator = std::allocator<T>> class list
         while (_M_begin != _M_end)
         {
             auto begin = _M_begin.load();
-            _M_begin.store(begin->_M_next);
+            _M_begin.store(begin->next());
             node_type::deallocate(_M_allocator_node, begin);
         }
         node_type::deallocate(_M_allocator_node, _M_end.load());
@@ -169,7 +396,21 @@ template <typename T, typename Allocator = std::allocator<T>> class list
 };
 
 
-template <typename T, typename TEqual = std::equal_to<T>, typename Allocator = std::allocator<T>> 
+/*
+   Harris-Michael ordered list. Nodes are sorted by TOrder (a hash, values
+   with the same order are kept in insertion order), so a miss stops at the
+   first greater node instead of walking the whole chain. The order of a
+   value is computed once and kept in its node, a walk never calls TOrder. An erase claims the
+   node through _M_deleted, marks its next pointer and swings the
+   predecessor past it; a traversal that runs into a marked node the erase
+   could not unlink helps unlinking it.
+
+   Counter is sharded_counter or std::atomic, a set that is one bucket of a
+   table passes the smaller atomic.
+*/
+template <typename T, typename TEqual = std::equal_to<T>, typename Allocator = std::allocator<T>,
+          typename Counter = sharded_counter<typename std::allocator_traits<Allocator>::size_type>,
+          typename TOrder = std::hash<T>>
 class set
 {
   public:
@@ -188,30 +429,33 @@ class set
     using node_ptr = node_type *;
     using allocator_node = typename alloc_traits::template rebind_alloc<node_type>;
 
-    set()
+    set() : set(Allocator())
+    {
+    }
+
+    explicit set(const Allocator &allocator) : _M_allocator(allocator)
     {
-        _M_end.store(node_type::allocate(_M_allocator));
-        _M_end.load()->_M_nil = true;
+        _M_end.store(node_type::nil());
         _M_begin = _M_end.load();
     }
 
     ~set()
     {
-        auto start = _M_begin.load();
+        auto start = untag(_M_begin.load());
         auto last = _M_end.load();
         while (start != last)
         {
-            auto next = start->_M_next;
+            auto next = start->next();
             node_type::deallocate(_M_allocator, start);
             start = next;
         }
-        node_type::deallocate(_M_allocator, last);
     }
 
     iterator begin()
     {
-        auto ret = iterator(_M_begin.load());
-        if (_M_begin.load()->_M_deleted)
+        auto head = untag(_M_begin.load());
+        auto ret = iterator(head);
+        if (head->_M_deleted)
         {
             ++ret;
         }
@@ -228,93 +472,250 @@ class set
         return _M_count.load();
     }
 
-    iterator find(const T &value)
+    template <typename K> iterator find(const K &value)
     {
-        auto ret = begin();
-        auto last = end();
-        while (ret != last && *ret != value)
-        {
-            ++ret;
-        }
-        return ret;
+        return find(value, _M_order(value));
     }
 
-    size_t insert(T value)
+    /*
+       value is anything TEqual compares against T and order its TOrder, a
+       bucket is looked up by key and hash. The walk is guarded, the caller
+       only needs a memory::EpochGuard to keep using the returned iterator.
+    */
+    template <typename K> iterator find(const K &value, std::uint64_t order)
     {
-        
-        // start point
-        node_ptr orig_head = _M_begin.load();
-        // step-1 Check if the value already exists in the list;
+        memory::EpochGuard guard;
+        auto last = _M_end.load();
+        auto curr = untag(_M_begin.load());
+        // read only walk, nodes erased on the way are left to the writers
+        while (curr != last)
         {
-            auto start = orig_head;
-            auto last = _M_end.load();
-            while (start != last && start->_M_value != value)
+            if (curr->_M_order > order)
             {
-                start = start->_M_next;
+                break;
             }
-            if (start != last)
+            if (curr->_M_order == order && !curr->_M_deleted && _M_equal(curr->_M_value, value))
             {
-                return 0;
+                return iterator(curr);
             }
+            curr = curr->next();
         }
-        // step-2 allocate new node and try insert into begin of the list
-        auto new_node = node_type::allocate(_M_allocator);
-        new_node->_M_next = orig_head;
-        new_node->_M_value = value;
-        while (!_M_begin.compare_exchange_strong(new_node->_M_next, new_node))
-        {
-            // step-3 this case only occurs when the head was change by another
-            // thread, so we need first update our begin reference,
-            // try find if the new node is equals to the value and try again if necessary
+        return end();
+    }
 
-            auto head = new_node->_M_next;
-            while (head != _M_end && head != orig_head)
-            {
+    size_t insert(T value)
+    {
+        const auto order = _M_order(value);
+        return insert(std::move(value), order);
+    }
 
-                if (head->_M_value == value)
+    size_t insert(T value, std::uint64_t order)
+    {
+        memory::EpochGuard guard;
+        node_ptr node = nullptr;
+        while (true)
+        {
+            auto pos = search(value, order);
+            if (pos._M_prev == nullptr || pos._M_found)
+            {
+                if (node)
                 {
-                    node_type::deallocate(_M_allocator, new_node);
-                    return 0;
+                    node_type::deallocate(_M_allocator, node);
                 }
-                head = head->_M_next;
+                return 0;
+            }
+            if (node == nullptr)
+            {
+                node = node_type::allocate(_M_allocator);
+                node->_M_value = value;
+                node->_M_order = order;
+            }
+            node->_M_next.store(pos._M_curr);
+            if (pos._M_prev->compare_exchange_strong(pos._M_curr, node))
+            {
+                break;
             }
-            orig_head = new_node->_M_next;
         }
         ++_M_count;
         return 1;
     }
 
-    iterator erase(T value)
+    template <typename K> size_type erase(const K &value)
+    {
+        return erase(value, _M_order(value));
+    }
+
+    template <typename K> size_type erase(const K &value, std::uint64_t order)
     {
-        auto ret = find(value);
-        if (ret == end())
+        memory::EpochGuard guard;
+        while (true)
         {
-            return ret;
+            auto pos = search(value, order);
+            if (!pos._M_found)
+            {
+                return 0;
+            }
+            auto node = pos._M_curr;
+            bool expected = false;
+            if (!node->_M_deleted.compare_exchange_strong(expected, true))
+            {
+                // erased or migrated meanwhile
+                continue;
+            }
+            --_M_count;
+            node->mark();
+            if (pos._M_prev->compare_exchange_strong(pos._M_curr, node->next()))
+            {
+                node_type::retire(_M_allocator, node);
+            }
+            else
+            {
+                search(value, order);
+            }
+            return 1;
         }
-        auto raw = ret.get_unsafe_pointer();
-        bool expected = false;
-        if (raw->_M_deleted.compare_exchange_strong(expected, true))
+    }
+
+    /*
+       Resize support, the low bits of _M_begin mark the set as FROZEN (no
+       more inserts, erases fail) and MIGRATED (every live value was handed to
+       the new table). Live nodes are claimed through _M_deleted, so an erase
+       either wins before the migration or fails and retries on the new table.
+       The migration marks every node before claiming it, so no insert can
+       link a node behind one it already walked past.
+    */
+    bool frozen() const
+    {
+        return (tags(_M_begin.load()) & FROZEN) != 0;
+    }
+
+    void wait_migrated() const
+    {
+        while ((tags(_M_begin.load()) & MIGRATED) == 0)
         {
-            --_M_count;
+            std::this_thread::yield();
         }
-        else
+    }
+
+    // only the thread that freezes the set moves the values with func(value, order), the others wait
+    template <typename Func> bool migrate(Func &&func)
+    {
+        memory::EpochGuard guard;
+        auto head = _M_begin.load();
+        while ((tags(head) & FROZEN) == 0)
         {
-            return end();
+            if (_M_begin.compare_exchange_weak(head, tag(head, FROZEN)))
+            {
+                auto last = _M_end.load();
+                for (auto node = head; node != last; node = node->next())
+                {
+                    node->mark();
+                    bool expected = false;
+                    if (node->_M_deleted.compare_exchange_strong(expected, true))
+                    {
+                        --_M_count;
+                        func(node->_M_value, node->_M_order);
+                    }
+                }
+                _M_begin.store(tag(head, FROZEN | MIGRATED));
+                return true;
+            }
         }
-        ++ret; // return the next one;
-        return ret;
+        wait_migrated();
+        return false;
     }
 
   private:
+    constexpr static std::uintptr_t FROZEN = 0x1;
+    constexpr static std::uintptr_t MIGRATED = 0x2;
+
+    // _M_prev is null when the set is frozen
+    struct position
+    {
+        std::atomic<node_ptr> *_M_prev;
+        node_ptr _M_curr;
+        bool _M_found;
+    };
+
+    /*
+       Live node equal to value, or the link where value goes: behind the
+       last node not ordered after it. Marked nodes on the way are unlinked,
+       the thread whose CAS succeeds retires them. The caller holds a guard.
+    */
+    template <typename K> position search(const K &value, std::uint64_t order)
+    {
+        const auto last = _M_end.load();
+        while (true)
+        {
+            std::atomic<node_ptr> *prev = &_M_begin;
+            auto curr = prev->load();
+            if (tags(curr) != 0)
+            {
+                return {nullptr, untag(curr), false};
+            }
+            bool restart = false;
+            while (curr != last)
+            {
+                auto next = curr->_M_next.load();
+                if (node_type::is_marked(next))
+                {
+                    // fails when the predecessor changed, is marked too or the set was frozen
+                    if (!prev->compare_exchange_strong(curr, node_type::unmarked(next)))
+                    {
+                        restart = true;
+                        break;
+                    }
+                    node_type::retire(_M_allocator, curr);
+                    curr = node_type::unmarked(next);
+                    continue;
+                }
+                if (curr->_M_order > order)
+                {
+                    break;
+                }
+                if (curr->_M_order == order && !curr->_M_deleted && _M_equal(curr->_M_value, value))
+                {
+                    return {prev, curr, true};
+                }
+                prev = &curr->_M_next;
+                curr = next;
+            }
+            if (!restart)
+            {
+                return {prev, curr, false};
+            }
+        }
+    }
+
+    static node_ptr untag(node_ptr ptr)
+    {
+        return reinterpret_cast<node_ptr>(reinterpret_cast<std::uintptr_t>(ptr) & ~(FROZEN | MIGRATED));
+    }
+
+    static node_ptr tag(node_ptr ptr, std::uintptr_t bits)
+    {
+        return reinterpret_cast<node_ptr>(reinterpret_cast<std::uintptr_t>(ptr) | bits);
+    }
+
+    static std::uintptr_t tags(node_ptr ptr)
+    {
+        return reinterpret_cast<std::uintptr_t>(ptr) & (FROZEN | MIGRATED);
+    }
+
     std::atomic<node_type *> _M_begin;
     std::atomic<node_type *> _M_end;
-    std::atomic<size_type> _M_count;
+    Counter _M_count{};
     allocator_node _M_allocator;
+    TEqual _M_equal;
+    TOrder _M_order;
 };
 
 
 
 /*
+   Bucket array of the lock free tables with the state of its migration.
+   The array comes from Allocator, memory::huge_page_allocator maps a big
+   one on huge pages.
  */
 template <class T, class Allocator = std::allocator<T>> struct VecTable
 {
@@ -335,7 +736,7 @@ template <class T, class Allocator = std::allocator<T>> struct VecTable
         READY = 2
     };
 
-    reference operator[](int index)
+    reference operator[](size_type index)
     {
         return _M_buckets[index];
     }
@@ -373,51 +774,69 @@ template <class T, class Allocator = std::allocator<T>> struct VecTable
         return _M_state.load();
     }
 
+    // hands out the next count buckets to a thread helping the resize
+    size_type claim_migration(size_type count)
+    {
+        return _M_migrate_index.fetch_add(count);
+    }
+
+    // true only for the thread that moved the last buckets
+    bool migrated(size_type count)
+    {
+        return _M_migrated.fetch_add(count) + count == _M_capacity;
+    }
+
+    // bounds the inserts taken while this table is the target of a
+    // migration, the other half of the capacity is kept for the moved buckets
+    bool try_reserve()
+    {
+        return _M_reserved.fetch_add(1) < _M_capacity / 2;
+    }
+
+    // table this one migrates to, set before the migration opens
+    VecTable *next()
+    {
+        return _M_next.load();
+    }
+
+    void set_next(VecTable *next)
+    {
+        _M_next.store(next);
+    }
+
     template <typename Alloc, typename... Params> static VecTable *allocate(Alloc allocator, Params &&...params)
     {
         auto ptr = std::allocator_traits<Alloc>::allocate(allocator, 1);
-        new (static_cast<void *>(ptr)) htable(std::forward<Params>(params)...);
+        new (static_cast<void *>(ptr)) VecTable(std::forward<Params>(params)...);
         return ptr;
     }
 
-    template <typename Alloc> static void deallocate(Alloc allocator, pointer ptr)
+    template <typename Alloc> static void deallocate(Alloc allocator, VecTable *ptr)
     {
         std::allocator_traits<Alloc>::destroy(allocator, ptr);
         std::allocator_traits<Alloc>::deallocate(allocator, ptr, 1);
     }
 
-    explicit VecTable(size_type capacity) :_M_capacity(capacity), _M_size(capacity), _M_state(State::LOCKED), _M_buckets(nullptr)
+    explicit VecTable(size_type capacity) : _M_size(capacity), _M_capacity(capacity), _M_buckets(nullptr)
     {
         _M_buckets = CreateVecTable(_M_alloc_bucket, _M_size);
     }
 
-    VecTable(VecTable& other, const size_type capacity)
-    {
-        _M_capacity = capacity;
-        _M_size = capacity;
-        pointer ret = alloc_traits::allocate(_M_alloc_bucket, capacity);
-        _M_buckets = ret;
-        const auto &old_capacity = other._M_capacity;
-        for (size_type i = 0; i < old_capacity; ++i)
-        {
-            ret = std::addressof(other[i]);
-            ++ret;
-        }
-        const auto& rest = capacity - old_capacity;
-        for (size_type i = 0; i < rest; ++i)
-        {
-            alloc_traits::construct(allocator, std::addressof(ret[i]));
-        }
-
-    }
+    VecTable(const VecTable &) = delete;
+    VecTable &operator=(const VecTable &) = delete;
 
     void release()
     {
-        DestroyVecTable(_M_alloc_bucket, _M_buckets, _M_size);
+        if (_M_buckets != nullptr)
+        {
+            DestroyVecTable(_M_alloc_bucket, _M_buckets, _M_size);
+            _M_buckets = nullptr;
+        }
     }
 
     ~VecTable()
     {
+        release();
     }
 
   private:
@@ -441,148 +860,1451 @@ template <class T, class Allocator = std::allocator<T>> struct VecTable
         alloc_traits::deallocate(allocator, buckets, size);
     }
 
+    // read by every operation
     allocator_type _M_alloc_bucket;
     std::atomic<State> _M_state = State::LOCKED;
+    std::atomic<VecTable *> _M_next = nullptr;
     size_type _M_size;
     size_type _M_capacity;
     pointer _M_buckets;
+    // written by the threads helping a resize
+    alignas(cache_line_size) std::atomic<size_type> _M_migrate_index = 0;
+    std::atomic<size_type> _M_migrated = 0;
+    std::atomic<size_type> _M_reserved = 0;
 };
 
-template<typename Key, typename Value, 
-        typename HashFunc = std::hash<Key>,
-        typename Compare = std::equal_to<Key>,
-        typename Allocator = std::allocator<std::pair<Key, Value>>>
-class HashTable
+/*
+   std::hash is the identity for integers, the bits are mixed before taking
+   the index so sequential or strided keys do not build long probe runs.
+*/
+inline std::uint64_t mix_hash(std::uint64_t hash)
 {
-  public:
-    using value_type = std::pair<Key, Value>; 
-    using allocator = Allocator;
-    
-    using set_type = typename set<Key, Compare>;
-    using bucket_type = typename VecTable<set_type>;
-    using size_type = typename bucket_type::size_type;
-    using bucket_wrap_ptr = memory::WrapPtr<bucket_type>;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// bit reversal, the order of split ordered lists and of HashTable::scan cursors
+inline std::uint64_t reverse_bits(std::uint64_t value)
+{
+    value = ((value >> 1) & 0x5555555555555555ULL) | ((value & 0x5555555555555555ULL) << 1);
+    value = ((value >> 2) & 0x3333333333333333ULL) | ((value & 0x3333333333333333ULL) << 2);
+    value = ((value >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((value & 0x0f0f0f0f0f0f0f0fULL) << 4);
+    value = ((value >> 8) & 0x00ff00ff00ff00ffULL) | ((value & 0x00ff00ff00ff00ffULL) << 8);
+    value = ((value >> 16) & 0x0000ffff0000ffffULL) | ((value & 0x0000ffff0000ffffULL) << 16);
+    return (value >> 32) | (value << 32);
+}
 
-    using weak_bucket_ptr = memory::weak_unique_ptr<bucket_type>;
+/*
+   Result of an operation on a bucket policy, MOVED means that the bucket was
+   frozen by a resize and the operation must be retried on the new table.
+*/
+enum class BucketStatus : std::uint8_t
+{
+    FAILED = 0,
+    SUCCESS = 1,
+    MOVED = 2,
+    FULL = 3
+};
 
-    HashTable()  
+// stores func(value) in value, func may run more than once when writers race
+template <typename Value, typename Func> void apply_update(std::atomic<Value> &value, Func &&func)
+{
+    auto current = value.load();
+    while (!value.compare_exchange_weak(current, func(current)))
     {
-        _M_bucket1.reset(new bucket_type(1 << 18));
-        auto bucket = _M_bucket1.try_acquire();
-        bucket->update();
-        bucket->ready();
-
-        _M_current_bucket.store(&_M_bucket1);
-        _M_old_bucket.store(&_M_bucket2);
     }
+}
+
+/*
+   Element of a chained bucket. The value is atomic so it can be updated in
+   place, _M_writers counts the updates in flight: a writer registers before
+   checking that the node is still live and a migration claims the node
+   before waiting for the count to drop, so no update is lost in the move.
+*/
+template <typename Key, typename Value> struct chain_entry
+{
+    chain_entry() = default;
 
-    void insert(value_type value)
+    chain_entry(const Key &key, const Value &value) : _M_key(key), _M_value(value)
     {
-        const auto use_bucket1 = _M_use_bucket1.load();
-        auto& bucket = use_bucket1 ? _M_bucket1 : _M_bucket2;
-        auto vec = bucket.try_acquire();
-        const auto capacity = vec->capacity();
-        auto index = get_index(value.first, capacity);
-        auto ret = (*vec)[index].insert(value.first);
-        
-        if (_M_use_bucket1.load() != use_bucket1)
-        {
-            bucket.release();
-            insert(value);
-        }
-        else
-        {
-           
-            if (load_factor(capacity) >= _M_max_load_factor)
-            {
-                if (vec->lock())
-                {
-                    auto& oldbucket = use_bucket1 ? _M_bucket2 : _M_bucket1;
-                    bucket_type* new_bucket = nullptr; // new bucket_type(bucket, capacity << 1);
-                    auto ret = oldbucket.reset(new_bucket);
-                    new_bucket->update();
-                    _M_use_bucket1.store(!use_bucket1);
-                    rehash(vec, new_bucket);
-                    new_bucket->ready();
-                    bucket.release(); //segundo release para limpar o container
-                }
-            }
-        }
-         
-        bucket.release();
-        _M_size.fetch_add(ret);
     }
 
-    void find(const Key& key)
+    chain_entry(const chain_entry &other) : _M_key(other._M_key), _M_value(other._M_value.load())
     {
-        auto bucket = _M_current_bucket.load();
-        auto vec = bucket->try_acquire();
-        if (vec)
-        {
-            const auto capacity = vec->capacity();
-            auto index = get_index(key, capacity);
-            auto ret = (*vec)[index].find(key);
-            if (!ret.second && (*vec).state() == bucket_type::State::UPDATING)
-            {
-                bucket->release();
-                bucket = _M_old_bucket.load();
-                vec = bucket->try_acquire();
-                if (vec)
-                {
-                    index = get_index(key, vec->capacity());
-                    ret = (*vec)[index].find(key);
-                    bucket->relase();
-                }
-            }
-        }
     }
 
-    size_type size()
+    chain_entry &operator=(const chain_entry &other)
     {
-        return _M_size.load();
+        _M_key = other._M_key;
+        _M_value.store(other._M_value.load());
+        return *this;
     }
 
+    Key _M_key;
+    std::atomic<Value> _M_value;
+    mutable std::atomic<std::uint32_t> _M_writers = 0;
+};
 
-    inline const float load_factor(const float capacity) const
-    {
-        return _M_size.load() / capacity;
-    }
-    
-  private:
+// bucket on a cache line of its own, writers of neighbouring buckets do not false share
+template <typename Bucket> struct alignas(cache_line_size) padded_bucket : Bucket
+{
+};
 
-    inline size_type get_index(const Key& key, const size_type capacity)
-    {
-        auto hash = _M_hasher(key);
-        return hash % capacity;
-    }
+/*
+   Separate chaining, every bucket is a lf::set with its own nodes sorted by
+   the hash kept in the node, a resize moves entries without rehashing and
+   a lookup only compares the keys of entries with the same hash.
+   A bucket is the unit of migration: it is frozen, its live keys are
+   inserted into the new table and then it is marked as migrated.
+   PadBuckets gives every bucket its own cache line, about 2.5 times the
+   memory of packed buckets.
+
+   The functions of a bucket policy take the mixed hash of the key, the
+   bucket is its low bits.
+*/
+template <typename Key, typename Value, typename Compare, typename Allocator, bool PadBuckets>
+struct BasicChainingPolicy
+{
+    using value_type = std::pair<Key, Value>;
+    using entry_type = chain_entry<Key, Value>;
 
-    void rehash(bucket_type* _old, bucket_type* _new)
+    struct entry_equal
     {
-        auto size = _old->capacity();
-        auto new_capacity = _new->capacity();
-        for (size_type i = 0; i < size; ++i)
+        bool operator()(const entry_type &lhs, const entry_type &rhs) const
         {
-            auto start = (*_old)[i].begin();
-            auto end = (*_old)[i].end();
-            
-            for (; start != end; ++start)
-            {
-                auto index = get_index(*start, new_capacity);
-                (*_new)[index].insert(*start);
-            }
+            return Compare()(lhs._M_key, rhs._M_key);
         }
 
+        bool operator()(const entry_type &lhs, const Key &key) const
+        {
+            return Compare()(lhs._M_key, key);
+        }
+    };
+
+    // never called, entries are inserted and looked up with the hash of their key
+    struct entry_order
+    {
+    };
+
+    using entry_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<entry_type>;
+    // a bucket holds a few entries, one word instead of the cache lines of a sharded_counter
+    using entry_counter = std::atomic<typename std::allocator_traits<entry_allocator>::size_type>;
+    using set_type = set<entry_type, entry_equal, entry_allocator, entry_counter, entry_order>;
+    using bucket_type = std::conditional_t<PadBuckets, padded_bucket<set_type>, set_type>;
+    using bucket_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<bucket_type>;
+    using table_type = VecTable<bucket_type, bucket_allocator>;
+    using size_type = typename table_type::size_type;
+
+    static BucketStatus insert(table_type &table, std::uint64_t hash, const value_type &value)
+    {
+        auto &bucket = bucket_of(table, hash);
+        if (bucket.insert(entry_type(value.first, value.second), hash))
+        {
+            return BucketStatus::SUCCESS;
+        }
+        return bucket.frozen() ? BucketStatus::MOVED : BucketStatus::FAILED;
+    }
+
+    static void prefetch(table_type &table, std::uint64_t hash)
+    {
+        memory::prefetch(&bucket_of(table, hash));
+    }
+
+    // copies the value of key to value when it is not null
+    static BucketStatus find(table_type &table, std::uint64_t hash, const Key &key, Value *value)
+    {
+        auto &bucket = bucket_of(table, hash);
+        {
+            memory::EpochGuard guard;
+            auto it = bucket.find(key, hash);
+            if (it != bucket.end())
+            {
+                if (value)
+                {
+                    *value = (*it)._M_value.load();
+                }
+                return BucketStatus::SUCCESS;
+            }
+        }
+        // a miss on a frozen bucket may be a key that is being moved
+        if (bucket.frozen())
+        {
+            bucket.wait_migrated();
+            return BucketStatus::MOVED;
+        }
+        return BucketStatus::FAILED;
+    }
+
+    // replaces the value of key with func(value), MOVED when the node went away meanwhile
+    template <typename Func>
+    static BucketStatus update(table_type &table, std::uint64_t hash, const Key &key, Func &&func)
+    {
+        auto &bucket = bucket_of(table, hash);
+        memory::EpochGuard guard;
+        auto it = bucket.find(key, hash);
+        if (it == bucket.end())
+        {
+            return bucket.frozen() ? BucketStatus::MOVED : BucketStatus::FAILED;
+        }
+        auto node = it.get_unsafe_pointer();
+        auto &entry = node->_M_value;
+        entry._M_writers.fetch_add(1);
+        if (node->_M_deleted.load())
+        {
+            entry._M_writers.fetch_sub(1);
+            return BucketStatus::MOVED;
+        }
+        apply_update(entry._M_value, func);
+        entry._M_writers.fetch_sub(1);
+        return BucketStatus::SUCCESS;
+    }
+
+    static BucketStatus erase(table_type &table, std::uint64_t hash, const Key &key)
+    {
+        auto &bucket = bucket_of(table, hash);
+        if (bucket.erase(key, hash))
+        {
+            return BucketStatus::SUCCESS;
+        }
+        return bucket.frozen() ? BucketStatus::MOVED : BucketStatus::FAILED;
+    }
+
+    // moves bucket index of _old, hash_of gives the hash of a key
+    template <typename HashOf> static void migrate(table_type &_old, table_type &_new, size_type index, HashOf &&)
+    {
+        _old[index].migrate([&](const entry_type &entry, std::uint64_t hash) {
+            while (entry._M_writers.load() != 0)
+            {
+                std::this_thread::yield();
+            }
+            bucket_of(_new, hash).insert(entry, hash);
+        });
+    }
+
+    // the whole chain of the key lives in a single bucket
+    template <typename HashOf>
+    static void migrate_key(table_type &_old, table_type &_new, std::uint64_t hash, HashOf &&hash_of)
+    {
+        migrate(_old, _new, hash & (_old.capacity() - 1), hash_of);
+    }
+
+    // calls func(key, value) on the live entries of bucket index, a frozen
+    // bucket returns once its entries are in the new table
+    template <typename HashOf, typename Func>
+    static void scan(table_type &table, size_type index, HashOf &&, Func &&func)
+    {
+        auto &bucket = table[index];
+        memory::EpochGuard guard;
+        for (auto it = bucket.begin(); it != bucket.end(); ++it)
+        {
+            const auto &entry = *it;
+            func(entry._M_key, entry._M_value.load());
+        }
+        if (bucket.frozen())
+        {
+            bucket.wait_migrated();
+        }
+    }
+
+  private:
+    static bucket_type &bucket_of(table_type &table, std::uint64_t hash)
+    {
+        return table[hash & (table.capacity() - 1)];
+    }
+};
+
+template <typename Key, typename Value, typename Compare, typename Allocator>
+using ChainingPolicy = BasicChainingPolicy<Key, Value, Compare, Allocator, false>;
+
+template <typename Key, typename Value, typename Compare, typename Allocator>
+using PaddedChainingPolicy = BasicChainingPolicy<Key, Value, Compare, Allocator, true>;
+
+/*
+   Slot of the open addressing policy, key and value live inline and the
+   state is published last, so a reader that sees FULL also sees the key.
+
+   EMPTY -> BUSY -> FULL -> DELETED
+
+   A resize freezes the slot setting MOVED on top of the current state, a
+   FULL slot also carries COPYING until its pair is in the new table. The
+   key and the value stay readable until the old table is released.
+   In place updates of the value register in _M_writers first, the same way
+   as chain_entry. _M_fingerprint holds the top byte of the hash and is
+   compared before the key, it is written before the state is published.
+*/
+template <typename Key, typename Value> struct flat_slot
+{
+    using key_type = Key;
+    using mapped_type = Value;
+
+    enum State : std::uint8_t
+    {
+        EMPTY = 0,
+        BUSY = 1,
+        FULL = 2,
+        DELETED = 3
+    };
+
+    constexpr static std::uint8_t COPYING = 0x40;
+    constexpr static std::uint8_t MOVED = 0x80;
+
+    std::atomic<std::uint8_t> _M_state = EMPTY;
+    std::uint8_t _M_fingerprint = 0;
+    std::atomic<std::uint16_t> _M_writers = 0;
+    Key _M_key;
+    std::atomic<Value> _M_value;
+};
+
+/*
+   Open addressing with linear probing over a flat array of slots, there is
+   no allocation per element and a probe usually touches a single cache line.
+   Deleted slots stay as tombstones until the next resize, an insert that
+   passes TOMBSTONE_LIMIT of them reports FULL to ask for one. Reusing a
+   tombstone would let two inserts of the same key land in two slots.
+   A slot is the unit of migration, a key is migrated by freezing its probe
+   run up to the first empty slot.
+*/
+template <typename Key, typename Value, typename Compare, typename Allocator> struct OpenAddressingPolicy
+{
+    using value_type = std::pair<Key, Value>;
+    using slot_type = flat_slot<Key, Value>;
+    using slot_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<slot_type>;
+    using table_type = VecTable<slot_type, slot_allocator>;
+    using size_type = typename table_type::size_type;
+
+    static BucketStatus insert(table_type &table, std::uint64_t hash, const value_type &value)
+    {
+        return insert(table, hash, value, TOMBSTONE_LIMIT);
+    }
+
+    // reports FULL after passing that many tombstones
+    static BucketStatus insert(table_type &table, std::uint64_t hash, const value_type &value, size_type tombstones)
+    {
+        const size_type mask = table.capacity() - 1;
+        size_type index = hash & mask;
+        for (size_type probe = 0; probe < table.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            auto &slot = table[index];
+            auto state = slot._M_state.load(std::memory_order_acquire);
+            if (state == slot_type::EMPTY &&
+                slot._M_state.compare_exchange_strong(state, slot_type::BUSY, std::memory_order_acquire))
+            {
+                slot._M_fingerprint = fingerprint(hash);
+                slot._M_key = value.first;
+                slot._M_value.store(value.second, std::memory_order_relaxed);
+                slot._M_state.store(slot_type::FULL, std::memory_order_release);
+                return BucketStatus::SUCCESS;
+            }
+            // the slot may be taken by another writer with the same key
+            state = wait_ready(slot, state);
+            if (state & slot_type::MOVED)
+            {
+                return BucketStatus::MOVED;
+            }
+            if (state == slot_type::FULL && holds(slot, hash, value.first))
+            {
+                return BucketStatus::FAILED;
+            }
+            if (state == slot_type::DELETED && --tombstones == 0)
+            {
+                return BucketStatus::FULL;
+            }
+        }
+        return BucketStatus::FULL;
+    }
+
+    static void prefetch(table_type &table, std::uint64_t hash)
+    {
+        memory::prefetch(&table[hash & (table.capacity() - 1)]);
+    }
+
+    // copies the value of key to value when it is not null
+    static BucketStatus find(table_type &table, std::uint64_t hash, const Key &key, Value *value)
+    {
+        const size_type mask = table.capacity() - 1;
+        size_type index = hash & mask;
+        for (size_type probe = 0; probe < table.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            auto &slot = table[index];
+            const auto state = slot._M_state.load(std::memory_order_acquire);
+            const auto base = state & ~(slot_type::MOVED | slot_type::COPYING);
+            if (base == slot_type::EMPTY)
+            {
+                // a writer may have frozen the run before inserting the key in the new table
+                return (state & slot_type::MOVED) ? BucketStatus::MOVED : BucketStatus::FAILED;
+            }
+            if (base == slot_type::FULL && holds(slot, hash, key))
+            {
+                if ((state & slot_type::MOVED) == 0)
+                {
+                    if (value)
+                    {
+                        *value = slot._M_value.load();
+                    }
+                    return BucketStatus::SUCCESS;
+                }
+                // the new table holds the current state of the key
+                wait_ready(slot, state);
+                return BucketStatus::MOVED;
+            }
+        }
+        return BucketStatus::FAILED;
+    }
+
+    template <typename Func>
+    static BucketStatus update(table_type &table, std::uint64_t hash, const Key &key, Func &&func)
+    {
+        const size_type mask = table.capacity() - 1;
+        size_type index = hash & mask;
+        for (size_type probe = 0; probe < table.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            auto &slot = table[index];
+            auto state = wait_ready(slot, slot._M_state.load(std::memory_order_acquire));
+            if (state & slot_type::MOVED)
+            {
+                return BucketStatus::MOVED;
+            }
+            if (state == slot_type::EMPTY)
+            {
+                return BucketStatus::FAILED;
+            }
+            if (state == slot_type::FULL && holds(slot, hash, key))
+            {
+                slot._M_writers.fetch_add(1);
+                if (slot._M_state.load() != slot_type::FULL)
+                {
+                    // erased or frozen meanwhile
+                    slot._M_writers.fetch_sub(1);
+                    return BucketStatus::MOVED;
+                }
+                apply_update(slot._M_value, func);
+                slot._M_writers.fetch_sub(1);
+                return BucketStatus::SUCCESS;
+            }
+        }
+        return BucketStatus::FAILED;
+    }
+
+    static BucketStatus erase(table_type &table, std::uint64_t hash, const Key &key)
+    {
+        const size_type mask = table.capacity() - 1;
+        size_type index = hash & mask;
+        for (size_type probe = 0; probe < table.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            auto &slot = table[index];
+            auto state = wait_ready(slot, slot._M_state.load(std::memory_order_acquire));
+            if (state & slot_type::MOVED)
+            {
+                return BucketStatus::MOVED;
+            }
+            if (state == slot_type::EMPTY)
+            {
+                return BucketStatus::FAILED;
+            }
+            if (state == slot_type::FULL && holds(slot, hash, key))
+            {
+                if (slot._M_state.compare_exchange_strong(state, slot_type::DELETED, std::memory_order_acq_rel))
+                {
+                    return BucketStatus::SUCCESS;
+                }
+                if (state & slot_type::MOVED)
+                {
+                    return BucketStatus::MOVED;
+                }
+            }
+        }
+        return BucketStatus::FAILED;
+    }
+
+    // moves slot index of _old, hash_of gives the hash of a key
+    template <typename HashOf>
+    static void migrate(table_type &_old, table_type &_new, size_type index, HashOf &&hash_of)
+    {
+        migrate_slot(_old, _new, index, hash_of);
+    }
+
+    template <typename HashOf>
+    static void migrate_key(table_type &_old, table_type &_new, std::uint64_t hash, HashOf &&hash_of)
+    {
+        const size_type mask = _old.capacity() - 1;
+        size_type index = hash & mask;
+        for (size_type probe = 0; probe < _old.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            if (migrate_slot(_old, _new, index, hash_of) == slot_type::EMPTY)
+            {
+                return;
+            }
+        }
+    }
+
+    // calls func(key, value) on the live keys whose home slot is index, they
+    // sit in the probe run that starts there; moved slots are already in the new table
+    template <typename HashOf, typename Func>
+    static void scan(table_type &table, size_type index, HashOf &&hash_of, Func &&func)
+    {
+        const size_type mask = table.capacity() - 1;
+        const size_type home = index;
+        for (size_type probe = 0; probe < table.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            auto &slot = table[index];
+            const auto state = wait_ready(slot, slot._M_state.load(std::memory_order_acquire));
+            if ((state & ~slot_type::MOVED) == slot_type::EMPTY)
+            {
+                return;
+            }
+            if (state == slot_type::FULL && (hash_of(slot._M_key) & mask) == home)
+            {
+                func(slot._M_key, slot._M_value.load());
+            }
+        }
+    }
+
+  private:
+    constexpr static size_type TOMBSTONE_LIMIT = 32;
+
+    // the index uses the low bits of the hash
+    static std::uint8_t fingerprint(std::uint64_t hash)
+    {
+        return static_cast<std::uint8_t>(hash >> 56);
+    }
+
+    static bool holds(const slot_type &slot, std::uint64_t hash, const Key &key)
+    {
+        return slot._M_fingerprint == fingerprint(hash) && Compare()(slot._M_key, key);
+    }
+
+    static std::uint8_t wait_ready(slot_type &slot, std::uint8_t state)
+    {
+        while (state == slot_type::BUSY || (state & slot_type::COPYING))
+        {
+            state = slot._M_state.load(std::memory_order_acquire);
+        }
+        return state;
+    }
+
+    // freezes the slot and copies it when this thread wins the freeze,
+    // returns the state the slot had before being frozen
+    template <typename HashOf>
+    static std::uint8_t migrate_slot(table_type &_old, table_type &_new, size_type index, HashOf &&hash_of)
+    {
+        auto &slot = _old[index];
+        auto state = wait_ready(slot, slot._M_state.load(std::memory_order_acquire));
+        while ((state & slot_type::MOVED) == 0)
+        {
+            const std::uint8_t frozen =
+                state == slot_type::FULL ? (state | slot_type::MOVED | slot_type::COPYING) : (state | slot_type::MOVED);
+            if (slot._M_state.compare_exchange_weak(state, frozen))
+            {
+                if (state == slot_type::FULL)
+                {
+                    while (slot._M_writers.load() != 0)
+                    {
+                        std::this_thread::yield();
+                    }
+                    // erases on the new table leave tombstones too, the copy must not give up on them
+                    insert(_new, hash_of(slot._M_key), {slot._M_key, slot._M_value.load()}, _new.capacity());
+                    slot._M_state.store(slot_type::FULL | slot_type::MOVED, std::memory_order_release);
+                }
+                return state;
+            }
+            state = wait_ready(slot, state);
+        }
+        return state & ~slot_type::MOVED;
+    }
+};
+
+// keys and values that fit one half of a memory::wide_word each
+template <typename Key, typename Value>
+constexpr bool fits_pair_slot = sizeof(Key) == sizeof(std::uint64_t) && sizeof(Value) == sizeof(std::uint64_t) &&
+                                std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>;
+
+/*
+   Slot of the pair slot policy, the key bits sit in the low word and the
+   value bits in the high word, every change of the slot is one double width
+   CAS so there is neither a BUSY window nor a writer count.
+   The state is kept in reserved bit patterns: the key EMPTY marks a free
+   slot and the three highest values an erased key (DELETED), a key being
+   copied by a resize (COPYING) and a frozen slot (MOVED). Erased and frozen
+   slots keep their key, once written the key of a slot never changes so
+   readers load the two words one at a time.
+*/
+struct pair_slot
+{
+    constexpr static std::uint64_t EMPTY = ~std::uint64_t(0);
+    constexpr static std::uint64_t DELETED = ~std::uint64_t(0);
+    constexpr static std::uint64_t COPYING = DELETED - 1;
+    constexpr static std::uint64_t MOVED = DELETED - 2;
+
+    memory::wide_word _M_word{EMPTY, 0};
+};
+
+/*
+   Open addressing over 16 byte pair slots, for 8 byte trivially copyable
+   keys and values. Same probing and migration as OpenAddressingPolicy but
+   insert, update and erase are a single memory::wide_compare_exchange and
+   a find is two plain loads. The key EMPTY and the values DELETED, COPYING
+   and MOVED of pair_slot are reserved, insert and update throw
+   std::invalid_argument for them rather than storing a slot state.
+*/
+template <typename Key, typename Value, typename Compare, typename Allocator> struct PairSlotPolicy
+{
+    static_assert(fits_pair_slot<Key, Value>, "PairSlotPolicy needs 8 byte trivially copyable keys and values");
+
+    using value_type = std::pair<Key, Value>;
+    using slot_type = pair_slot;
+    using slot_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<slot_type>;
+    using table_type = VecTable<slot_type, slot_allocator>;
+    using size_type = typename table_type::size_type;
+
+    static BucketStatus insert(table_type &table, std::uint64_t hash, const value_type &value)
+    {
+        const memory::wide_word desired{to_word(value.first), checked(to_word(value.second))};
+        if (desired._M_low == slot_type::EMPTY)
+        {
+            throw std::invalid_argument("pair slot key reserved for an empty slot");
+        }
+        const size_type mask = table.capacity() - 1;
+        size_type index = hash & mask;
+        for (size_type probe = 0; probe < table.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            auto &word = table[index]._M_word;
+            auto current = load(word);
+            while (true)
+            {
+                if (current._M_high == slot_type::COPYING || current._M_high == slot_type::MOVED)
+                {
+                    wait_copied(word);
+                    return BucketStatus::MOVED;
+                }
+                const bool same = current._M_low != slot_type::EMPTY && holds(current, value.first);
+                if (current._M_low != slot_type::EMPTY && !same)
+                {
+                    break;
+                }
+                if (same && current._M_high != slot_type::DELETED)
+                {
+                    return BucketStatus::FAILED;
+                }
+                // a free slot or the tombstone of the same key, a failed CAS reloads current
+                if (memory::wide_compare_exchange(word, current, desired))
+                {
+                    return BucketStatus::SUCCESS;
+                }
+            }
+        }
+        return BucketStatus::FULL;
+    }
+
+    static void prefetch(table_type &table, std::uint64_t hash)
+    {
+        memory::prefetch(&table[hash & (table.capacity() - 1)]);
+    }
+
+    // copies the value of key to value when it is not null
+    static BucketStatus find(table_type &table, std::uint64_t hash, const Key &key, Value *value)
+    {
+        std::uint64_t bits;
+        const auto ret = lookup(table, hash, key, bits);
+        if (ret == BucketStatus::SUCCESS && value)
+        {
+            *value = from_word<Value>(bits);
+        }
+        return ret;
+    }
+
+    // replaces the value of key with func(value)
+    template <typename Func>
+    static BucketStatus update(table_type &table, std::uint64_t hash, const Key &key, Func &&func)
+    {
+        return exchange(table, hash, key,
+                        [&](std::uint64_t bits) { return checked(to_word(func(from_word<Value>(bits)))); });
+    }
+
+    static BucketStatus erase(table_type &table, std::uint64_t hash, const Key &key)
+    {
+        return exchange(table, hash, key, [](std::uint64_t) { return slot_type::DELETED; });
+    }
+
+    // moves slot index of _old, hash_of gives the hash of a key
+    template <typename HashOf>
+    static void migrate(table_type &_old, table_type &_new, size_type index, HashOf &&hash_of)
+    {
+        migrate_slot(_old, _new, index, hash_of);
+    }
+
+    template <typename HashOf>
+    static void migrate_key(table_type &_old, table_type &_new, std::uint64_t hash, HashOf &&hash_of)
+    {
+        const size_type mask = _old.capacity() - 1;
+        size_type index = hash & mask;
+        for (size_type probe = 0; probe < _old.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            if (migrate_slot(_old, _new, index, hash_of))
+            {
+                return;
+            }
+        }
+    }
+
+    // same contract as OpenAddressingPolicy::scan
+    template <typename HashOf, typename Func>
+    static void scan(table_type &table, size_type index, HashOf &&hash_of, Func &&func)
+    {
+        const size_type mask = table.capacity() - 1;
+        const size_type home = index;
+        for (size_type probe = 0; probe < table.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            auto &word = table[index]._M_word;
+            const auto bits = memory::load_word(word._M_low);
+            if (bits == slot_type::EMPTY)
+            {
+                return;
+            }
+            const auto value = wait_copied(word);
+            const auto key = from_word<Key>(bits);
+            if (value < slot_type::MOVED && (hash_of(key) & mask) == home)
+            {
+                func(key, from_word<Value>(value));
+            }
+        }
+    }
+
+  private:
+    // value bits that do not collide with a slot state
+    static std::uint64_t checked(std::uint64_t bits)
+    {
+        if (bits >= slot_type::MOVED)
+        {
+            throw std::invalid_argument("pair slot value reserved for a slot state");
+        }
+        return bits;
+    }
+
+    template <typename T> static std::uint64_t to_word(const T &value)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    template <typename T> static T from_word(std::uint64_t bits)
+    {
+        T value;
+        std::memcpy(&value, &bits, sizeof(bits));
+        return value;
+    }
+
+    // the halves are read apart, a torn pair only costs a failed CAS
+    static memory::wide_word load(memory::wide_word &word)
+    {
+        const auto low = memory::load_word(word._M_low);
+        return {low, memory::load_word(word._M_high)};
+    }
+
+    static bool holds(const memory::wide_word &current, const Key &key)
+    {
+        return Compare()(from_word<Key>(current._M_low), key);
+    }
+
+    // the value word once no copy of the slot is in flight
+    static std::uint64_t wait_copied(memory::wide_word &word)
+    {
+        auto value = memory::load_word(word._M_high);
+        while (value == slot_type::COPYING)
+        {
+            value = memory::load_word(word._M_high);
+        }
+        return value;
+    }
+
+    // the value bits of key in bits, FAILED for an erased key
+    static BucketStatus lookup(table_type &table, std::uint64_t hash, const Key &key, std::uint64_t &bits)
+    {
+        const size_type mask = table.capacity() - 1;
+        size_type index = hash & mask;
+        for (size_type probe = 0; probe < table.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            auto &word = table[index]._M_word;
+            const memory::wide_word current{memory::load_word(word._M_low), 0};
+            if (current._M_low == slot_type::EMPTY)
+            {
+                // a writer may have frozen the run before inserting the key in the new table
+                return memory::load_word(word._M_high) == slot_type::MOVED ? BucketStatus::MOVED
+                                                                           : BucketStatus::FAILED;
+            }
+            if (holds(current, key))
+            {
+                bits = wait_copied(word);
+                if (bits == slot_type::MOVED)
+                {
+                    return BucketStatus::MOVED;
+                }
+                return bits == slot_type::DELETED ? BucketStatus::FAILED : BucketStatus::SUCCESS;
+            }
+        }
+        return BucketStatus::FAILED;
+    }
+
+    // swaps the value of a live key for next(value) with one CAS
+    template <typename Next>
+    static BucketStatus exchange(table_type &table, std::uint64_t hash, const Key &key, Next &&next)
+    {
+        const size_type mask = table.capacity() - 1;
+        size_type index = hash & mask;
+        for (size_type probe = 0; probe < table.capacity(); ++probe, index = (index + 1) & mask)
+        {
+            auto &word = table[index]._M_word;
+            memory::wide_word current{memory::load_word(word._M_low), 0};
+            if (current._M_low == slot_type::EMPTY)
+            {
+                return memory::load_word(word._M_high) == slot_type::MOVED ? BucketStatus::MOVED
+                                                                           : BucketStatus::FAILED;
+            }
+            if (!holds(current, key))
+            {
+                continue;
+            }
+            current._M_high = memory::load_word(word._M_high);
+            while (true)
+            {
+                if (current._M_high == slot_type::COPYING || current._M_high == slot_type::MOVED)
+                {
+                    wait_copied(word);
+                    return BucketStatus::MOVED;
+                }
+                if (current._M_high == slot_type::DELETED)
+                {
+                    return BucketStatus::FAILED;
+                }
+                if (memory::wide_compare_exchange(word, current, {current._M_low, next(current._M_high)}))
+                {
+                    return BucketStatus::SUCCESS;
+                }
+            }
+        }
+        return BucketStatus::FAILED;
+    }
+
+    // freezes the slot and copies it when this thread wins the freeze, true when the slot was empty
+    template <typename HashOf>
+    static bool migrate_slot(table_type &_old, table_type &_new, size_type index, HashOf &&hash_of)
+    {
+        auto &word = _old[index]._M_word;
+        auto current = load(word);
+        while (true)
+        {
+            if (current._M_high == slot_type::COPYING || current._M_high == slot_type::MOVED)
+            {
+                wait_copied(word);
+                return current._M_low == slot_type::EMPTY;
+            }
+            const bool live = current._M_low != slot_type::EMPTY && current._M_high != slot_type::DELETED;
+            memory::wide_word frozen{current._M_low, live ? slot_type::COPYING : slot_type::MOVED};
+            if (memory::wide_compare_exchange(word, current, frozen))
+            {
+                if (live)
+                {
+                    const auto key = from_word<Key>(current._M_low);
+                    insert(_new, hash_of(key), {key, from_word<Value>(current._M_high)});
+                    // nobody else changes a COPYING slot
+                    memory::wide_compare_exchange(word, frozen, {current._M_low, slot_type::MOVED});
+                }
+                return current._M_low == slot_type::EMPTY;
+            }
+        }
+    }
+};
+
+/*
+   Lock free hash table, the layout of the buckets is given by BucketPolicy.
+
+   The current bucket array is a plain atomic pointer and every operation
+   runs inside a memory::EpochGuard, pinning the table only writes the
+   epoch record of the calling thread so readers share no cache line. A
+   table that was replaced is retired to the epoch domain and freed once no
+   thread can still be reading it.
+
+   Resize is incremental: the thread that locks a full table links a table
+   with twice the capacity as its next() and opens the migration
+   (State::UPDATING). From then on every writer moves a chunk of buckets and
+   the bucket of its own key before touching the new table, readers look in
+   the old table and only go to the new one when they hit a frozen bucket.
+   The writer that moves the last chunk makes the new table the current one.
+*/
+template <typename Key, typename Value, typename HashFunc = std::hash<Key>, typename Compare = std::equal_to<Key>,
+          typename Allocator = std::allocator<std::pair<Key, Value>>,
+          template <class, class, class, class> class BucketPolicy = ChainingPolicy>
+class HashTable
+{
+  public:
+    using value_type = std::pair<Key, Value>;
+    using allocator = Allocator;
+
+    using policy_type = BucketPolicy<Key, Value, Compare, Allocator>;
+    using bucket_type = typename policy_type::table_type;
+    using size_type = typename bucket_type::size_type;
+
+    static_assert(std::is_trivially_copyable<Value>::value, "values are stored in std::atomic");
+
+    HashTable() : HashTable(1 << 18)
+    {
+    }
+
+    // bucket_count is rounded up to a power of two
+    explicit HashTable(size_type bucket_count)
+    {
+        size_type capacity = 1;
+        while (capacity < bucket_count)
+        {
+            capacity <<= 1;
+        }
+        auto table = new bucket_type(capacity);
+        table->update();
+        table->ready();
+        _M_table.store(table);
+    }
+
+    /*
+       Bulk build from the random access range [first, last), the bucket
+       array is sized for the whole input up front. The input is hashed by
+       slices and counting sorted into threads partitions of consecutive
+       buckets, then every partition is inserted by its own thread: no two
+       threads touch a bucket, so no link retries and no resize runs. A key
+       that repeats keeps its first value, threads 0 uses every core.
+    */
+    template <typename RandomIt>
+    HashTable(RandomIt first, RandomIt last, size_type threads = 0)
+        : HashTable(std::max<size_type>(16, static_cast<size_type>((last - first) / _M_max_load_factor) + 1))
+    {
+        static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                      typename std::iterator_traits<RandomIt>::iterator_category>::value,
+                      "bulk build needs a random access range");
+        bulk_insert(first, static_cast<size_type>(last - first), threads);
+    }
+
+    HashTable(const HashTable &) = delete;
+    HashTable &operator=(const HashTable &) = delete;
+
+    ~HashTable()
+    {
+        auto vec = _M_table.load();
+        if (vec->state() == bucket_type::State::UPDATING)
+        {
+            // unfinished migration
+            delete vec->next();
+        }
+        delete vec;
+    }
+
+    bool insert(value_type value)
+    {
+        auto ret = modify(value.first, true, [&](bucket_type &table, std::uint64_t hash) {
+            return policy_type::insert(table, hash, value);
+        });
+        if (ret == BucketStatus::SUCCESS)
+        {
+            ++_M_size;
+            return true;
+        }
+        return false;
+    }
+
+    std::optional<Value> find(const Key &key)
+    {
+        const auto hash = hash_of(key);
+        while (true)
+        {
+            Value value{};
+            auto ret = BucketStatus::MOVED;
+            {
+                memory::EpochGuard guard;
+                auto vec = acquire_current();
+                ret = policy_type::find(*vec, hash, key, &value);
+                if (ret == BucketStatus::MOVED)
+                {
+                    // next() is set before any bucket is frozen
+                    auto next = vec->next();
+                    ret = policy_type::find(*next, hash, key, &value);
+                }
+            }
+            if (ret == BucketStatus::SUCCESS)
+            {
+                return value;
+            }
+            if (ret == BucketStatus::FAILED)
+            {
+                return std::nullopt;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    bool erase(const Key &key)
+    {
+        auto ret = modify(key, false, [&](bucket_type &table, std::uint64_t hash) {
+            return policy_type::erase(table, hash, key);
+        });
+        if (ret == BucketStatus::SUCCESS)
+        {
+            --_M_size;
+            return true;
+        }
+        return false;
+    }
+
+    /*
+       In place updates, the value of an existing key is changed with atomic
+       operations on the stored value and never replaces the element. A key
+       that is missing is inserted, when another thread inserts it first the
+       update is applied to that element instead.
+    */
+
+    // returns true when key was inserted, false when an existing value was replaced
+    bool upsert(const Key &key, const Value &value)
+    {
+        while (true)
+        {
+            if (update(key, [&](const Value &) { return value; }))
+            {
+                return false;
+            }
+            if (insert({key, value}))
+            {
+                return true;
+            }
+        }
+    }
+
+    // make(key) may run in several threads racing on the same key, only one result is kept
+    template <typename Func> Value compute_if_absent(const Key &key, Func &&make)
+    {
+        while (true)
+        {
+            if (auto value = find(key))
+            {
+                return *value;
+            }
+            Value value = make(key);
+            if (insert({key, value}))
+            {
+                return value;
+            }
+        }
+    }
+
+    // adds delta to the value of key (inserting it with delta) and returns the previous value
+    Value fetch_add(const Key &key, const Value &delta)
+    {
+        while (true)
+        {
+            Value previous{};
+            if (update(key, [&](const Value &current) {
+                    previous = current;
+                    return current + delta;
+                }))
+            {
+                return previous;
+            }
+            if (insert({key, delta}))
+            {
+                return Value{};
+            }
+        }
+    }
+
+    /*
+       Batched entry points, keys is any contiguous range (std::span, vector,
+       array). Keys are handled in groups of _M_batch: the whole group is
+       hashed and its buckets prefetched before the first one is resolved, so
+       the cache misses of the group overlap. A key that hits a resize goes
+       through the single key path once the group released the table.
+    */
+    template <typename Values> size_type insert_batch(const Values &values)
+    {
+        size_type inserted = 0;
+        for_each_batch(
+            values, [](const value_type &value) -> const Key & { return value.first; },
+            [&](bucket_type *vec, std::uint64_t hash, const value_type &value, size_type) {
+                if (vec->state() == bucket_type::State::UPDATING)
+                {
+                    return false;
+                }
+                auto ret = policy_type::insert(*vec, hash, value);
+                if (ret == BucketStatus::SUCCESS)
+                {
+                    ++_M_size;
+                    if (load_factor(vec->capacity()) >= _M_max_load_factor)
+                    {
+                        start_resize(vec);
+                    }
+                    ++inserted;
+                }
+                return ret == BucketStatus::SUCCESS || ret == BucketStatus::FAILED;
+            },
+            [&](const value_type &value, size_type) { inserted += insert(value); }, [](size_type) {});
+        return inserted;
+    }
+
+    // writes one bool per key to result
+    template <typename Keys, typename OutputIt> OutputIt find_batch(const Keys &keys, OutputIt result)
+    {
+        bool found[_M_batch];
+        for_each_batch(
+            keys, [](const Key &key) -> const Key & { return key; },
+            [&](bucket_type *vec, std::uint64_t hash, const Key &key, size_type i) {
+                auto ret = policy_type::find(*vec, hash, key, nullptr);
+                found[i] = ret == BucketStatus::SUCCESS;
+                return ret != BucketStatus::MOVED;
+            },
+            [&](const Key &key, size_type i) { found[i] = find(key).has_value(); },
+            [&](size_type group) { result = std::copy(found, found + group, result); });
+        return result;
+    }
+
+    template <typename Keys> size_type erase_batch(const Keys &keys)
+    {
+        size_type erased = 0;
+        for_each_batch(
+            keys, [](const Key &key) -> const Key & { return key; },
+            [&](bucket_type *vec, std::uint64_t hash, const Key &key, size_type) {
+                if (vec->state() == bucket_type::State::UPDATING)
+                {
+                    return false;
+                }
+                auto ret = policy_type::erase(*vec, hash, key);
+                if (ret == BucketStatus::SUCCESS)
+                {
+                    --_M_size;
+                    ++erased;
+                }
+                return ret != BucketStatus::MOVED;
+            },
+            [&](const Key &key, size_type) { erased += erase(key); }, [](size_type) {});
+        return erased;
+    }
+
+    /*
+       Resumable scan in the style of Redis SCAN: start with cursor 0 and
+       pass the returned cursor back until it is 0 again. Every call runs
+       func(key, value) on the elements of one bucket index, while a
+       migration is open also on the buckets it splits into in the new
+       table. Cursors walk the indexes in reverse binary order, so a table
+       that grew between two calls does not revisit or skip the buckets
+       already done: an element present for the whole scan is returned at
+       least once, some may be returned twice.
+    */
+    template <typename Func> std::uint64_t scan(std::uint64_t cursor, Func &&func)
+    {
+        memory::EpochGuard guard;
+        auto vec = acquire_current();
+        const std::uint64_t mask = vec->capacity() - 1;
+        // the old bucket first, an element it loses meanwhile is found in the next table
+        for (auto table = vec; table != nullptr; table = table->next())
+        {
+            for (auto index = cursor & mask; index < table->capacity(); index += mask + 1)
+            {
+                policy_type::scan(*table, index, hash_func(), func);
+            }
+        }
+        cursor |= ~mask;
+        return reverse_bits(reverse_bits(cursor) + 1);
+    }
+
+    size_type size()
+    {
+        return _M_size.load();
+    }
+
+    size_type bucket_count()
+    {
+        memory::EpochGuard guard;
+        return acquire_current()->capacity();
+    }
+
+    // checked on every insert, reads the approximate size
+    inline const float load_factor(const float capacity) const
+    {
+        return _M_size.approx() / capacity;
+    }
+    
+  private:
+
+    inline std::uint64_t hash_of(const Key &key)
+    {
+        return mix_hash(_M_hasher(key));
+    }
+
+    // func(0) runs on the calling thread, func(1 .. threads - 1) on their own threads, the first exception is rethrown
+    template <typename Func> static void run_parallel(size_type threads, Func &&func)
+    {
+        std::vector<std::exception_ptr> errors(threads);
+        auto run = [&func, &errors](size_type t) {
+            try
+            {
+                func(t);
+            }
+            catch (...)
+            {
+                errors[t] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_type t = 1; t < threads; ++t)
+        {
+            workers.emplace_back(run, t);
+        }
+        run(0);
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        for (auto &error : errors)
+        {
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    // fills the table while it is private to the constructor
+    template <typename RandomIt> void bulk_insert(RandomIt first, size_type count, size_type threads)
+    {
+        if (threads == 0)
+        {
+            threads = std::max<size_type>(1, std::thread::hardware_concurrency());
+        }
+        threads = std::max<size_type>(1, std::min(threads, count / _M_bulk_grain));
+        auto &table = *_M_table.load();
+        const size_type mask = table.capacity() - 1;
+        const size_type span = (table.capacity() + threads - 1) / threads;
+        const size_type slice = (count + threads - 1) / threads;
+        auto partition = [&](std::uint64_t hash) { return (hash & mask) / span; };
+
+        // offsets[t * threads + p] counts, then places, the keys of slice t that go to partition p
+        std::vector<std::uint64_t> hash(count);
+        std::vector<size_type> offsets(threads * threads);
+        run_parallel(threads, [&](size_type t) {
+            for (size_type i = t * slice; i < std::min(count, (t + 1) * slice); ++i)
+            {
+                hash[i] = hash_of(first[i].first);
+                ++offsets[t * threads + partition(hash[i])];
+            }
+        });
+        size_type sum = 0;
+        for (size_type p = 0; p < threads; ++p)
+        {
+            for (size_type t = 0; t < threads; ++t)
+            {
+                sum += std::exchange(offsets[t * threads + p], sum);
+            }
+        }
+        // stable, so every partition holds its keys in input order
+        std::vector<size_type> order(count);
+        run_parallel(threads, [&](size_type t) {
+            for (size_type i = t * slice; i < std::min(count, (t + 1) * slice); ++i)
+            {
+                order[offsets[t * threads + partition(hash[i])]++] = i;
+            }
+        });
+        // the last slice leaves every cursor at the end of its partition
+        const auto ends = offsets.begin() + (threads - 1) * threads;
+        run_parallel(threads, [&](size_type p) {
+            std::int64_t added = 0;
+            for (size_type k = p ? ends[p - 1] : 0; k < ends[p]; ++k)
+            {
+                const value_type value(first[order[k]]);
+                added += policy_type::insert(table, hash[order[k]], value) == BucketStatus::SUCCESS;
+            }
+            _M_size.add(added);
+        });
+    }
+
+    // replaces the value of key with func(value), false when key is not in the table
+    template <typename Func> bool update(const Key &key, Func &&func)
+    {
+        auto ret = modify(key, false, [&](bucket_type &table, std::uint64_t hash) {
+            return policy_type::update(table, hash, key, func);
+        });
+        return ret == BucketStatus::SUCCESS;
+    }
+
+    /*
+       Runs op on the table that owns key until it reports SUCCESS or FAILED.
+       While a migration is open op runs on the new table once the bucket of
+       key was moved, an op that grows the table may trigger the resize and is
+       bounded by try_reserve on the new table.
+    */
+    template <typename Op> BucketStatus modify(const Key &key, bool grows, Op &&op)
+    {
+        const auto hash = hash_of(key);
+        while (true)
+        {
+            auto ret = BucketStatus::MOVED;
+            {
+                memory::EpochGuard guard;
+                auto vec = acquire_current();
+                if (vec->state() != bucket_type::State::UPDATING)
+                {
+                    // a LOCKED table is still in use while the new one is allocated
+                    ret = op(*vec, hash);
+                    if (grows && (ret == BucketStatus::FULL ||
+                                  (ret == BucketStatus::SUCCESS && load_factor(vec->capacity()) >= _M_max_load_factor)))
+                    {
+                        start_resize(vec);
+                    }
+                }
+                else
+                {
+                    ret = apply_on_next(vec, hash, [&](bucket_type &next) {
+                        // wait for the migration when the new table is taking too many inserts
+                        return !grows || next.try_reserve() ? op(next, hash) : BucketStatus::MOVED;
+                    });
+                }
+            }
+
+            if (ret == BucketStatus::SUCCESS || ret == BucketStatus::FAILED)
+            {
+                return ret;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // the caller holds a memory::EpochGuard for as long as it uses the table
+    bucket_type *acquire_current()
+    {
+        return _M_table.load();
+    }
+
+    /*
+       The thread that locks the table links the new one and opens the
+       migration. A table full of tombstones with few live keys is rehashed
+       at the same capacity, the migration only copies live keys.
+    */
+    void start_resize(bucket_type *vec)
+    {
+        if (!vec->lock())
+        {
+            return;
+        }
+        const auto grow = load_factor(vec->capacity()) >= _M_max_load_factor / 2;
+        auto next = new bucket_type(grow ? vec->capacity() << 1 : vec->capacity());
+        next->update();
+        next->ready();
+        vec->set_next(next);
+        vec->update();
+    }
+
+    // moves the next chunk of buckets, the thread that moves the last one
+    // makes the new table current and retires the old one
+    void help_resize(bucket_type *vec, bucket_type *next)
+    {
+        const auto capacity = vec->capacity();
+        const auto first = vec->claim_migration(_M_migration_chunk);
+        if (first >= capacity)
+        {
+            return;
+        }
+        const auto last = std::min(first + _M_migration_chunk, capacity);
+        for (auto i = first; i < last; ++i)
+        {
+            policy_type::migrate(*vec, *next, i, hash_func());
+        }
+        if (vec->migrated(last - first))
+        {
+            _M_table.store(next);
+            memory::EpochDomain::instance().retire(vec);
+        }
+    }
+
+    // runs op on the new table once the bucket of hash was moved
+    template <typename Op> BucketStatus apply_on_next(bucket_type *vec, std::uint64_t hash, Op &&op)
+    {
+        auto next = vec->next();
+        help_resize(vec, next);
+        policy_type::migrate_key(*vec, *next, hash, hash_func());
+        auto ret = op(*next);
+        // the new table is not resized while the migration is open
+        return ret == BucketStatus::FULL ? BucketStatus::MOVED : ret;
+    }
+
+    /*
+       Hashes and prefetches a group of keys on the pinned table and runs op
+       on each of them, the keys op could not resolve go to retry after the
+       table was released and done is called once the group is complete.
+    */
+    template <typename Range, typename KeyOf, typename Op, typename Retry, typename Done>
+    void for_each_batch(const Range &range, KeyOf &&key_of, Op &&op, Retry &&retry, Done &&done)
+    {
+        const auto first = std::data(range);
+        const size_type count = std::size(range);
+        std::uint64_t hash[_M_batch];
+        bool pending[_M_batch];
+        for (size_type base = 0; base < count; base += _M_batch)
+        {
+            const auto group = std::min(_M_batch, count - base);
+            {
+                memory::EpochGuard guard;
+                auto vec = acquire_current();
+                for (size_type i = 0; i < group; ++i)
+                {
+                    hash[i] = hash_of(key_of(first[base + i]));
+                    policy_type::prefetch(*vec, hash[i]);
+                }
+                for (size_type i = 0; i < group; ++i)
+                {
+                    pending[i] = !op(vec, hash[i], first[base + i], i);
+                }
+            }
+            for (size_type i = 0; i < group; ++i)
+            {
+                if (pending[i])
+                {
+                    retry(first[base + i], i);
+                }
+            }
+            done(group);
+        }
+    }
+
+    auto hash_func()
+    {
+        return [this](const Key &key) { return hash_of(key); };
     }
 
     constexpr static float _M_max_load_factor = 0.5f;
-    std::atomic_uint64_t _M_size = 0;
+    constexpr static size_type _M_migration_chunk = 64;
+    constexpr static size_type _M_batch = 16;
+    // smallest share of a bulk build worth a thread
+    constexpr static size_type _M_bulk_grain = 1 << 14;
+    // read by every operation, only written at the end of a resize
+    alignas(cache_line_size) std::atomic<bucket_type *> _M_table = nullptr;
     HashFunc _M_hasher;
-    bucket_wrap_ptr _M_bucket1;
-    bucket_wrap_ptr _M_bucket2;
-    std::atomic_bool _M_use_bucket1 = true;
-    std::atomic<bucket_wrap_ptr*> _M_current_bucket;
-    std::atomic<bucket_wrap_ptr*> _M_old_bucket;
-    
+    sharded_counter<std::uint64_t> _M_size;
 };
+
+template <typename Key, typename Value, typename HashFunc = std::hash<Key>, typename Compare = std::equal_to<Key>,
+          typename Allocator = std::allocator<std::pair<Key, Value>>>
+using FlatHashTable = HashTable<Key, Value, HashFunc, Compare, Allocator, OpenAddressingPolicy>;
+
+template <typename Key, typename Value, typename HashFunc = std::hash<Key>, typename Compare = std::equal_to<Key>,
+          typename Allocator = std::allocator<std::pair<Key, Value>>>
+using PaddedHashTable = HashTable<Key, Value, HashFunc, Compare, Allocator, PaddedChainingPolicy>;
+
+/*
+   Pair slots for 8 byte trivially copyable keys and values, flat slots for
+   everything else. With pair slots the key whose bits are all ones and the
+   three highest value bit patterns are reserved, see PairSlotPolicy.
+*/
+template <typename Key, typename Value, typename Compare, typename Allocator>
+using PackedPolicy = std::conditional_t<fits_pair_slot<Key, Value>, PairSlotPolicy<Key, Value, Compare, Allocator>,
+                                        OpenAddressingPolicy<Key, Value, Compare, Allocator>>;
+
+template <typename Key, typename Value, typename HashFunc = std::hash<Key>, typename Compare = std::equal_to<Key>,
+          typename Allocator = std::allocator<std::pair<Key, Value>>>
+using PackedHashTable = HashTable<Key, Value, HashFunc, Compare, Allocator, PackedPolicy>;
 } // namespace lf
 #endif
@@ -0,0 +1,324 @@
+#ifndef __HASH_TABLE_SPLIT_ORDERED__
+#define __HASH_TABLE_SPLIT_ORDERED__
+#include "hash_table_lock_free.hpp"
+
+namespace lf
+{
+
+// the split order of an element is the _M_order of its node
+template <typename Key, typename Value> struct split_entry
+{
+    Key _M_key;
+    Value _M_value;
+};
+
+/*
+   Split ordered list (Shalev and Shavit). Every element lives in a single
+   lock free list sorted by its bit reversed hash and the bucket index only
+   holds dummy nodes pointing into that list. Bucket b + 2^k sorts right after
+   the run of bucket b, so doubling the bucket count just publishes a bigger
+   index and the new buckets are spliced in lazily when first used, nodes are
+   never moved.
+
+   The index is a directory of segments: segment 0 holds bucket 0 and segment
+   s > 0 holds buckets [2^(s-1), 2^s), a segment is allocated on first use.
+   Erased nodes are unlinked Harris style (mark next, swing predecessor) and
+   retired to memory::EpochDomain.
+*/
+template <typename Key, typename Value, typename HashFunc = std::hash<Key>, typename Compare = std::equal_to<Key>,
+          typename Allocator = std::allocator<std::pair<Key, Value>>>
+class SplitOrderedHashTable
+{
+  public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<Key, Value>;
+    using size_type = std::size_t;
+    using entry_type = split_entry<Key, Value>;
+    using node_type = forward_node<entry_type>;
+    using allocator_node = typename std::allocator_traits<Allocator>::template rebind_alloc<node_type>;
+
+    SplitOrderedHashTable() : SplitOrderedHashTable(16)
+    {
+    }
+
+    explicit SplitOrderedHashTable(size_type bucket_count) : SplitOrderedHashTable(bucket_count, Allocator())
+    {
+    }
+
+    SplitOrderedHashTable(size_type bucket_count, const Allocator &allocator) : _M_allocator(allocator)
+    {
+        size_type capacity = 1;
+        while (capacity < bucket_count)
+        {
+            capacity <<= 1;
+        }
+        _M_bucket_count.store(capacity);
+        bucket_slot(0).store(node_type::allocate(_M_allocator));
+    }
+
+    SplitOrderedHashTable(const SplitOrderedHashTable &) = delete;
+    SplitOrderedHashTable &operator=(const SplitOrderedHashTable &) = delete;
+
+    ~SplitOrderedHashTable()
+    {
+        auto node = bucket_slot(0).load();
+        while (node)
+        {
+            auto next = node->next();
+            node_type::deallocate(_M_allocator, node);
+            node = next;
+        }
+        for (auto &segment : _M_segments)
+        {
+            delete[] segment.load();
+        }
+    }
+
+    // false when the key is already in the table, its value is kept
+    bool insert(const value_type &value)
+    {
+        memory::EpochGuard guard;
+        const auto hash = mix_hash(_M_hasher(value.first));
+        const auto order = regular_order(hash);
+        auto head = bucket_head(hash & (_M_bucket_count.load() - 1));
+
+        node_type *node = nullptr;
+        while (true)
+        {
+            auto pos = search(head, order, &value.first);
+            if (pos._M_found)
+            {
+                if (node)
+                {
+                    node_type::deallocate(_M_allocator, node);
+                }
+                return false;
+            }
+            if (node == nullptr)
+            {
+                node = node_type::allocate(_M_allocator);
+                node->_M_value = {value.first, value.second};
+                node->_M_order = order;
+            }
+            node->_M_next.store(pos._M_curr);
+            if (pos._M_prev->compare_exchange_strong(pos._M_curr, node))
+            {
+                break;
+            }
+        }
+
+        ++_M_size;
+        auto count = _M_bucket_count.load();
+        if (_M_size.approx() > count * MAX_LOAD)
+        {
+            _M_bucket_count.compare_exchange_strong(count, count << 1);
+        }
+        return true;
+    }
+
+    std::optional<Value> find(const Key &key)
+    {
+        memory::EpochGuard guard;
+        const auto hash = mix_hash(_M_hasher(key));
+        const auto order = regular_order(hash);
+        auto curr = bucket_head(hash & (_M_bucket_count.load() - 1))->next();
+        // read only walk, marked nodes are skipped and left for the writers to unlink
+        while (curr && curr->_M_order <= order)
+        {
+            auto next = curr->_M_next.load();
+            if (!node_type::is_marked(next) && curr->_M_order == order &&
+                _M_compare(curr->_M_value._M_key, key))
+            {
+                // written before the node was linked and never changed
+                return curr->_M_value._M_value;
+            }
+            curr = node_type::unmarked(next);
+        }
+        return std::nullopt;
+    }
+
+    bool erase(const Key &key)
+    {
+        memory::EpochGuard guard;
+        const auto hash = mix_hash(_M_hasher(key));
+        const auto order = regular_order(hash);
+        auto head = bucket_head(hash & (_M_bucket_count.load() - 1));
+        while (true)
+        {
+            auto pos = search(head, order, &key);
+            if (!pos._M_found)
+            {
+                return false;
+            }
+            auto next = pos._M_curr->_M_next.load();
+            // marking the next pointer is the erase, whoever wins owns the node
+            if (node_type::is_marked(next) ||
+                !pos._M_curr->_M_next.compare_exchange_strong(next, node_type::marked(next)))
+            {
+                continue;
+            }
+            --_M_size;
+            if (pos._M_prev->compare_exchange_strong(pos._M_curr, next))
+            {
+                node_type::retire(_M_allocator, pos._M_curr);
+            }
+            else
+            {
+                search(head, order, &key);
+            }
+            return true;
+        }
+    }
+
+    size_type size() const
+    {
+        return _M_size.load();
+    }
+
+    size_type bucket_count() const
+    {
+        return _M_bucket_count.load();
+    }
+
+  private:
+    constexpr static size_type SEGMENTS = 64;
+    // elements per bucket before the bucket count doubles
+    constexpr static size_type MAX_LOAD = 2;
+
+    struct position
+    {
+        std::atomic<node_type *> *_M_prev;
+        node_type *_M_curr;
+        bool _M_found;
+    };
+
+    static std::uint64_t regular_order(std::uint64_t hash)
+    {
+        return reverse_bits(hash | 0x8000000000000000ULL);
+    }
+
+    static std::uint64_t dummy_order(size_type bucket)
+    {
+        return reverse_bits(bucket);
+    }
+
+    static size_type bit_width(std::uint64_t value)
+    {
+        size_type width = 0;
+        for (size_type shift = 32; shift > 0; shift >>= 1)
+        {
+            if (value >> shift)
+            {
+                value >>= shift;
+                width += shift;
+            }
+        }
+        return width + (value ? 1 : 0);
+    }
+
+    std::atomic<node_type *> &bucket_slot(size_type bucket)
+    {
+        const auto segment = bit_width(bucket);
+        const size_type first = segment ? size_type(1) << (segment - 1) : 0;
+        auto table = _M_segments[segment].load();
+        if (table == nullptr)
+        {
+            auto fresh = new std::atomic<node_type *>[segment ? first : 1]();
+            if (_M_segments[segment].compare_exchange_strong(table, fresh))
+            {
+                table = fresh;
+            }
+            else
+            {
+                delete[] fresh;
+            }
+        }
+        return table[bucket - first];
+    }
+
+    node_type *bucket_head(size_type bucket)
+    {
+        auto head = bucket_slot(bucket).load();
+        return head ? head : initialize_bucket(bucket);
+    }
+
+    // splices the dummy node of bucket into the run of its parent bucket
+    node_type *initialize_bucket(size_type bucket)
+    {
+        const auto parent = bucket_head(bucket & ~(size_type(1) << (bit_width(bucket) - 1)));
+        const auto order = dummy_order(bucket);
+        auto dummy = node_type::allocate(_M_allocator);
+        dummy->_M_order = order;
+        while (true)
+        {
+            auto pos = search(parent, order, nullptr);
+            if (pos._M_found)
+            {
+                node_type::deallocate(_M_allocator, dummy);
+                dummy = pos._M_curr;
+                break;
+            }
+            dummy->_M_next.store(pos._M_curr);
+            if (pos._M_prev->compare_exchange_strong(pos._M_curr, dummy))
+            {
+                break;
+            }
+        }
+        bucket_slot(bucket).store(dummy);
+        return dummy;
+    }
+
+    /*
+       First node from head that is not ordered before (order, key), a null
+       key looks for the dummy node. Marked nodes on the way are unlinked.
+    */
+    position search(node_type *head, std::uint64_t order, const Key *key)
+    {
+        while (true)
+        {
+            auto prev = &head->_M_next;
+            auto curr = prev->load();
+            bool restart = false;
+            while (curr)
+            {
+                auto next = curr->_M_next.load();
+                if (node_type::is_marked(next))
+                {
+                    if (!prev->compare_exchange_strong(curr, node_type::unmarked(next)))
+                    {
+                        restart = true;
+                        break;
+                    }
+                    node_type::retire(_M_allocator, curr);
+                    curr = node_type::unmarked(next);
+                    continue;
+                }
+                if (curr->_M_order > order)
+                {
+                    break;
+                }
+                if (curr->_M_order == order && (key == nullptr || _M_compare(curr->_M_value._M_key, *key)))
+                {
+                    return {prev, curr, true};
+                }
+                prev = &curr->_M_next;
+                curr = next;
+            }
+            if (!restart)
+            {
+                return {prev, curr, false};
+            }
+        }
+    }
+
+    sharded_counter<size_type> _M_size;
+    std::atomic<size_type> _M_bucket_count = 0;
+    std::atomic<std::atomic<node_type *> *> _M_segments[SEGMENTS] = {};
+    HashFunc _M_hasher;
+    Compare _M_compare;
+    allocator_node _M_allocator;
+};
+
+} // namespace lf
+#endif
@@ -121,18 +121,25 @@ template <typename Node> struct Iterator
     node_sptr m_data;
 };
 
-template <typename Key, typename Value> class OSIntervalTree
+template <typename Key, typename Value, typename Allocator = std::allocator<Pair<Key, Value>>> class OSIntervalTree
 {
   public:
     using node_type = Node<Pair<Key, Value>>;
     using node_sptr = typename node_type::node_sptr;
     using iterator = Iterator<node_type>;
+    using allocator_type = Allocator;
 
     OSIntervalTree() : m_size(0)
     {
         init();
     }
 
+    // nodes come from allocator, with memory::arena_allocator dropping the tree is one arena release
+    explicit OSIntervalTree(const Allocator &allocator) : m_size(0), m_allocator(allocator)
+    {
+        init();
+    }
+
     iterator begin()
     {
         if (m_root == m_nil)
@@ -186,7 +193,7 @@ template <typename Key, typename Value> class OSIntervalTree
 
     void insert(const Key &key, Value val, std::size_t weight = 1)
     {
-        node_sptr node = std::make_shared<node_type>();
+        node_sptr node = std::allocate_shared<node_type>(m_allocator);
         node->m_total = weight;
         node->m_value.first = key;
         node->m_value.second = val;
@@ -538,7 +545,7 @@ template <typename Key, typename Value> class OSIntervalTree
 
     void init()
     {
-        m_nil = std::make_shared<node_type>();
+        m_nil = std::allocate_shared<node_type>(m_allocator);
         m_nil->m_color = Color::Black;
         m_nil->m_nil = true;
         m_nil->m_size = 0;
@@ -550,4 +557,5 @@ template <typename Key, typename Value> class OSIntervalTree
     node_sptr m_root;
     node_sptr m_nil;
     size_t m_size;
+    Allocator m_allocator;
 };
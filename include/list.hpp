@@ -27,8 +27,8 @@ struct NodeList {
 	template<typename Allocator>
 	static void free_node(Allocator& allocator, node_ptr_ node)
 	{
-		node->~node_type_();
 		std::allocator_traits<Allocator>::destroy(allocator, node);
+		std::allocator_traits<Allocator>::deallocate(allocator, node, 1);
 	}
 };
 
@@ -109,10 +109,13 @@ class List {
 
 		List()
 		{
-			_M_end = node_type_::create_node(_M_allocator);
-			_M_end->_M_next = _M_end;
-			_M_end->_M_parent = _M_end;
-			_M_root = _M_end;
+			init();
+		}
+
+		// nodes come from allocator, memory::arena_allocator turns them into pointer bumps
+		explicit List(const Allocator& allocator) : _M_allocator(allocator)
+		{
+			init();
 		}
 
 		~List()
@@ -201,6 +204,14 @@ class List {
 			return _M_count;
 		}
 	private:
+		void init()
+		{
+			_M_end = node_type_::create_node(_M_allocator);
+			_M_end->_M_next = _M_end;
+			_M_end->_M_parent = _M_end;
+			_M_root = _M_end;
+		}
+
 		node_ptr_ _M_root;
 		node_ptr_ _M_end;
 		allocator_node _M_allocator;			
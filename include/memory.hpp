@@ -1,14 +1,379 @@
 #ifndef __SMART_PTR__
 #define __SMART_PTR__
 
+#include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#define MEMORY_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+#if defined(__SANITIZE_THREAD__)
+#define MEMORY_TSAN
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define MEMORY_TSAN
+#endif
+#endif
+#ifdef MEMORY_TSAN
+#include <sanitizer/tsan_interface.h>
+#endif
 
 
 namespace memory
 {
 
-template<typename T>
-class IntrusiveRefCount
+// hint only, brings the cache line of addr closer before it is dereferenced
+inline void prefetch(const void *addr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(static_cast<const char *>(addr), _MM_HINT_T0);
+#else
+    (void)addr;
+#endif
+}
+
+/*
+   Two adjacent 64 bit words updated as a unit by wide_compare_exchange,
+   the halves may still be loaded one at a time with load_word.
+*/
+struct alignas(16) wide_word
+{
+    std::uint64_t _M_low;
+    std::uint64_t _M_high;
+};
+
+inline std::uint64_t load_word(const std::uint64_t &word)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    // aligned 64 bit volatile loads are atomic with acquire semantics on x64
+    return *static_cast<const volatile std::uint64_t *>(&word);
+#else
+    return __atomic_load_n(&word, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// double width CAS, on failure expected receives the current 16 bytes read atomically
+inline bool wide_compare_exchange(wide_word &target, wide_word &expected, const wide_word &desired)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+    // cmpxchg16b is inlined without asking for -mcx16 (and libatomic) from every user of the header
+    bool exchanged;
+#ifdef MEMORY_TSAN
+    // the sanitizer does not see the asm, the CAS is a full barrier on target
+    __tsan_release(&target);
+#endif
+    __asm__ __volatile__("lock cmpxchg16b %1"
+                         : "=@ccz"(exchanged), "+m"(target), "+a"(expected._M_low), "+d"(expected._M_high)
+                         : "b"(desired._M_low), "c"(desired._M_high)
+                         : "memory");
+#ifdef MEMORY_TSAN
+    __tsan_acquire(&target);
+#endif
+    return exchanged;
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return _InterlockedCompareExchange128(reinterpret_cast<volatile long long *>(&target),
+                                          static_cast<long long>(desired._M_high),
+                                          static_cast<long long>(desired._M_low),
+                                          reinterpret_cast<long long *>(&expected)) != 0;
+#else
+    // casp on armv8.1, libatomic elsewhere
+    return __atomic_compare_exchange(&target, &expected, const_cast<wide_word *>(&desired), false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+class RefCount
+{
+  public:
+    void increment()
+    {
+        _M_count.fetch_add(1);
+    }
+
+    // true when the last reference is gone
+    bool decrement()
+    {
+        return _M_count.fetch_sub(1) == 1;
+    }
+
+    std::uint64_t count()
+    {
+        return _M_count.load();
+    }
+
+  private:
+    std::atomic_uint64_t _M_count = 1;
+};
+
+/*
+   Biased reference count. Most objects are only ever shared inside the
+   thread that created them, so that thread (the owner) counts in a plain
+   integer and every other thread in a shared atomic word. The owner merges
+   its count into the shared word when it drops to zero, from then on every
+   thread uses the shared word. A thread that would take the shared count
+   below zero while the owner still holds references queues the object to
+   the owner instead, with its reference: the owner merges queued objects
+   on its next decrement, on drain() or when it exits, and whoever takes
+   the merged count to zero releases. Objects released by a merge are
+   deleted through the virtual destructor.
+*/
+class BiasedRefCount
+{
+  public:
+    BiasedRefCount() : _M_owner(Queue::local())
+    {
+        if (_M_owner)
+        {
+            _M_biased = 1;
+        }
+        else
+        {
+            // created by a thread that is exiting, shared from the start
+            _M_merged = true;
+            _M_shared.store(UNIT | MERGED, std::memory_order_relaxed);
+        }
+    }
+
+    virtual ~BiasedRefCount() = default;
+
+    BiasedRefCount(const BiasedRefCount &) = delete;
+    BiasedRefCount &operator=(const BiasedRefCount &) = delete;
+
+    void increment()
+    {
+        if (owned())
+        {
+            ++_M_biased;
+            return;
+        }
+        _M_shared.fetch_add(UNIT, std::memory_order_relaxed);
+    }
+
+    // true when the last reference is gone
+    bool decrement()
+    {
+        if (!owned())
+        {
+            return release_shared();
+        }
+        // after a merge another thread may delete the object at any time
+        auto queue = _M_owner;
+        const bool last = --_M_biased == 0 && merge();
+        if (queue->_M_head.load(std::memory_order_relaxed))
+        {
+            queue->drain();
+        }
+        return last;
+    }
+
+    // exact on the owner thread, other threads only see the shared part
+    std::uint64_t count() const
+    {
+        const auto shared = _M_shared.load() >> SHIFT;
+        return static_cast<std::uint64_t>(shared + (owned() ? static_cast<std::int64_t>(_M_biased) : 0));
+    }
+
+    // merges the objects queued to the calling thread
+    static void drain()
+    {
+        if (auto queue = Queue::current())
+        {
+            queue->drain();
+        }
+    }
+
+  private:
+    // the shared word is the count shifted left by SHIFT and the two flags
+    constexpr static std::int64_t MERGED = 1;
+    constexpr static std::int64_t QUEUED = 2;
+    constexpr static int SHIFT = 2;
+    constexpr static std::int64_t UNIT = std::int64_t(1) << SHIFT;
+
+    /*
+       Objects handed to one owner thread. The queue outlives its thread,
+       objects still name it, and is closed on exit: a thread that finds it
+       closed merges the object itself, the owner count no longer changes.
+    */
+    struct Queue
+    {
+        constexpr static std::uintptr_t CLOSED = 1;
+
+        std::atomic<BiasedRefCount *> _M_head{nullptr};
+        Queue *_M_next = nullptr;
+
+        // false once the owner exited
+        bool push(BiasedRefCount *counter)
+        {
+            // acquire, on a closed queue the owner count is read next
+            auto head = _M_head.load(std::memory_order_acquire);
+            do
+            {
+                if (reinterpret_cast<std::uintptr_t>(head) == CLOSED)
+                {
+                    return false;
+                }
+                counter->_M_queued = head;
+            } while (!_M_head.compare_exchange_weak(head, counter, std::memory_order_release,
+                                                    std::memory_order_acquire));
+            return true;
+        }
+
+        void drain()
+        {
+            merge_all(_M_head.exchange(nullptr, std::memory_order_acquire));
+        }
+
+        void close()
+        {
+            merge_all(_M_head.exchange(reinterpret_cast<BiasedRefCount *>(CLOSED), std::memory_order_acq_rel));
+        }
+
+        static void merge_all(BiasedRefCount *counter)
+        {
+            while (counter)
+            {
+                auto next = counter->_M_queued;
+                // the owner may have merged it already when its own count dropped
+                if (!counter->_M_merged)
+                {
+                    counter->merge();
+                }
+                if (counter->release_merged())
+                {
+                    delete counter;
+                }
+                counter = next;
+            }
+        }
+
+        // trivially destructible so it can still be read after the thread closed its queue
+        struct Slot
+        {
+            Queue *_M_queue;
+            bool _M_closed;
+        };
+
+        struct Closer
+        {
+            Slot *_M_slot;
+
+            ~Closer()
+            {
+                auto queue = std::exchange(_M_slot->_M_queue, nullptr);
+                _M_slot->_M_closed = true;
+                queue->close();
+            }
+        };
+
+        static Slot &slot()
+        {
+            static thread_local Slot slot = {nullptr, false};
+            return slot;
+        }
+
+        static Queue *current()
+        {
+            return slot()._M_queue;
+        }
+
+        // queue of the calling thread, nullptr once it exits
+        static Queue *local()
+        {
+            auto &self = slot();
+            if (self._M_queue == nullptr && !self._M_closed)
+            {
+                self._M_queue = create();
+                static thread_local Closer closer = {&self};
+                (void)closer;
+            }
+            return self._M_queue;
+        }
+
+        static Queue *create()
+        {
+            // never freed, kept on a list so they stay reachable
+            static std::atomic<Queue *> queues{nullptr};
+            auto queue = new Queue();
+            queue->_M_next = queues.load(std::memory_order_relaxed);
+            while (!queues.compare_exchange_weak(queue->_M_next, queue))
+            {
+            }
+            return queue;
+        }
+    };
+
+    // _M_merged is only read by the owner, or by anyone once the owner exited
+    bool owned() const
+    {
+        return _M_owner && _M_owner == Queue::current() && !_M_merged;
+    }
+
+    // folds the owner count into the shared word, true when no reference is left
+    bool merge()
+    {
+        const auto biased = static_cast<std::int64_t>(std::exchange(_M_biased, 0));
+        _M_merged = true;
+        const auto word = _M_shared.fetch_add(biased * UNIT + MERGED, std::memory_order_acq_rel);
+        return (word >> SHIFT) + biased == 0;
+    }
+
+    bool release_merged()
+    {
+        return (_M_shared.fetch_sub(UNIT, std::memory_order_acq_rel) >> SHIFT) == 1;
+    }
+
+    bool release_shared()
+    {
+        auto word = _M_shared.load(std::memory_order_relaxed);
+        while (true)
+        {
+            if ((word & (MERGED | QUEUED)) == 0 && (word >> SHIFT) < 1)
+            {
+                if (_M_shared.compare_exchange_weak(word, word | QUEUED, std::memory_order_acq_rel))
+                {
+                    break;
+                }
+            }
+            else if (_M_shared.compare_exchange_weak(word, word - UNIT, std::memory_order_acq_rel))
+            {
+                return (word & MERGED) && (word >> SHIFT) == 1;
+            }
+        }
+        if (_M_owner->push(this))
+        {
+            return false;
+        }
+        // the owner exited, its count is final
+        merge();
+        return release_merged();
+    }
+
+    Queue *const _M_owner;
+    std::uint64_t _M_biased = 0;
+    bool _M_merged = false;
+    std::atomic<std::int64_t> _M_shared{0};
+    BiasedRefCount *_M_queued = nullptr;
+};
+
+template<typename T, typename ReferencePolicy = RefCount>
+class IntrusiveRefCount : public ReferencePolicy
 {
   public:
 
@@ -19,8 +384,7 @@ class IntrusiveRefCount
       
     template<typename... Params>
     IntrusiveRefCount(Params &&...args) : 
-        _M_data(std::forward<Params>(args)...), 
-        _M_count(1)
+        _M_data(std::forward<Params>(args)...)
     {
     }
 
@@ -39,22 +403,16 @@ class IntrusiveRefCount
     IntrusiveRefCount(IntrusiveRefCount<T> &&other) = delete;
     IntrusiveRefCount(const IntrusiveRefCount<T> &&other) = delete;
 
-    void increment()
-    {
-        ++_M_count;
-    }
-
     bool release()
     {
-        return --_M_count == 0;
+        return this->decrement();
     }
 
   private:
     T _M_data;
-    std::atomic_uint64_t _M_count;
 };
 
-template<typename Ty>
+template<typename Ty, typename ReferencePolicy = RefCount>
 class shared_ptr_a
 {
   public:
@@ -65,7 +423,7 @@ class shared_ptr_a
     
     template<typename... Params> shared_ptr_a(Params &&...args) 
     {
-        _M_refCount = new IntrusiveRefCount<Ty>(std::forward<Params>(args)...);
+        _M_refCount = new IntrusiveRefCount<Ty, ReferencePolicy>(std::forward<Params>(args)...);
     }
 
     pointer operator->()
@@ -78,8 +436,8 @@ class shared_ptr_a
         return *_M_refCount;
     }
 
-    shared_ptr_a(const shared_ptr_a<Ty> &other) = delete;
-    shared_ptr_a<Ty> &operator=(const shared_ptr_a<Ty> &other) = delete;
+    shared_ptr_a(const shared_ptr_a &other) = delete;
+    shared_ptr_a &operator=(const shared_ptr_a &other) = delete;
 
     /**
     Porque pegar primeiro o ref count e garantir a ordem de execuo?
@@ -87,15 +445,15 @@ class shared_ptr_a
     objeto esteja passando por uma atribuio, ento caso seja este o cenrio manter nesta ordem
     garante que pegamos um refcount vlido seja o antigo ou o novo
     */
-    shared_ptr_a(shared_ptr_a<Ty>& other)
+    shared_ptr_a(shared_ptr_a& other)
     {
         _M_refCount = other._M_refCount;
         _M_refCount->increment();
     }
 
-    shared_ptr_a<Ty>& operator=(shared_ptr_a<Ty> &other)
+    shared_ptr_a& operator=(shared_ptr_a &other)
     {
-        shared_ptr_a<Ty> tmp(other); //increment 1;
+        shared_ptr_a tmp(other); //increment 1;
         swap(tmp, *this);
         return *this;
     }
@@ -110,36 +468,14 @@ class shared_ptr_a
 
   private:
 
-    void swap(shared_ptr_a<Ty>& x, shared_ptr_a<Ty>& y)
+    void swap(shared_ptr_a& x, shared_ptr_a& y)
     {
         auto tmp = x._M_refCount;
         x._M_refCount = y._M_refCount;
         y._M_refCount = tmp;
     }
 
-    IntrusiveRefCount<Ty>* _M_refCount;
-};
-
-class RefCount
-{
-  public:
-    void increment()
-    {
-        _M_count.fetch_add(1);
-    }
-
-    void decrement()
-    {
-        _M_count.fetch_sub(1);
-    }
-
-    std::uint64_t count()
-    {
-        return _M_count.load();
-    }
-
-  private:
-    std::atomic_uint64_t _M_count = 1;
+    IntrusiveRefCount<Ty, ReferencePolicy>* _M_refCount;
 };
 
 template <typename T, typename ReferencePolicy = RefCount> class StorageRefCount : public ReferencePolicy
@@ -173,7 +509,7 @@ template <typename T, typename ReferencePolicy = RefCount> class StorageRefCount
     StorageRefCount<T, ReferencePolicy> operator=(const StorageRefCount<T, ReferencePolicy> &) = delete;
     StorageRefCount<T, ReferencePolicy> operator=(StorageRefCount<T, ReferencePolicy> &) = delete;
 
-    void release()
+    ~StorageRefCount()
     {
         delete _M_pointer;
     }
@@ -182,27 +518,33 @@ template <typename T, typename ReferencePolicy = RefCount> class StorageRefCount
     T* _M_pointer;
 };
 
-template<typename T>
+template<typename T, typename ReferencePolicy = RefCount>
 class SmartPtr
 {
   public:
 
-      using value_type = typename StorageRefCount<T>::value_type;
+      using storage_type = StorageRefCount<T, ReferencePolicy>;
+      using value_type = typename storage_type::value_type;
       using reference = value_type&;
       using pointer = value_type*;
 
     template<typename... Params>
     SmartPtr(Params &&...args)
     {
-        _M_count = new StorageRefCount<T>(std::forward<Params>(args)...);
+        _M_count = new storage_type(std::forward<Params>(args)...);
     }
 
-    SmartPtr(const SmartPtr<T> &other)
+    SmartPtr(const SmartPtr &other)
     {
         other._M_count->increment();
         _M_count = other._M_count;
     }
 
+    // a copy, not a forward to the constructor of T
+    SmartPtr(SmartPtr &other) : SmartPtr(static_cast<const SmartPtr &>(other))
+    {
+    }
+
     reference operator*()
     {
         return _M_count->operator*();
@@ -213,7 +555,7 @@ class SmartPtr
         return _M_count->operator->();
     }
 
-    reference operator=(SmartPtr<T>& other)
+    SmartPtr &operator=(const SmartPtr &other)
     {
         other._M_count->increment();
         //replace
@@ -223,6 +565,7 @@ class SmartPtr
         }
 
         _M_count = other._M_count;
+        return *this;
     }
 
     
@@ -233,15 +576,13 @@ class SmartPtr
 
     void decrement_and_release()
     {
-        _M_count->decrement();
-        if (_M_count->count() == 0)
+        if (_M_count->decrement())
         {
-            _M_count->release();
             delete _M_count;
         }
     }
   private:
-    StorageRefCount<T> *_M_count;
+    storage_type *_M_count;
 };
 
 
@@ -305,22 +646,22 @@ class WrapPtr : public RefCount2
 
     storage_type* try_acquire()
     {
-        
-        /*
         if (!increment_nz())
         {
             return nullptr;
-        }*/
-        increment();
+        }
         return _M_obj;
     }
 
 
     void release()
     {
+        // read the pointer while we still hold a reference, after the
+        // decrement reset() may already be storing the next object
+        auto obj = _M_obj;
         if (decrement() == 0)
         {
-            delete _M_obj;
+            delete obj;
         }
     }
 
@@ -380,5 +721,1510 @@ class weak_unique_ptr
     pointer _M_data = nullptr;
 };
 
+// object and internal count of a counted_ptr
+template <typename T> struct counted_block
+{
+    template <typename... Args> explicit counted_block(Args &&...args) : _M_value(std::forward<Args>(args)...)
+    {
+    }
+
+    // adds delta references, the one taking the count to zero deletes the block
+    static void adjust(counted_block *block, std::int64_t delta)
+    {
+        if (block && block->_M_count.fetch_add(delta) + delta == 0)
+        {
+            delete block;
+        }
+    }
+
+    std::atomic<std::int64_t> _M_count = 1;
+    T _M_value;
+};
+
+/*
+   Reference counted pointer with the count next to the object, the value
+   type loaded and stored by atomic_counted_ptr.
+*/
+template <typename T> class counted_ptr
+{
+  public:
+    using element_type = T;
+
+    counted_ptr() = default;
+
+    counted_ptr(const counted_ptr &other) : _M_block(other._M_block)
+    {
+        if (_M_block)
+        {
+            _M_block->_M_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    counted_ptr(counted_ptr &&other) noexcept : _M_block(std::exchange(other._M_block, nullptr))
+    {
+    }
+
+    counted_ptr &operator=(counted_ptr other) noexcept
+    {
+        std::swap(_M_block, other._M_block);
+        return *this;
+    }
+
+    ~counted_ptr()
+    {
+        counted_block<T>::adjust(_M_block, -1);
+    }
+
+    template <typename... Args> static counted_ptr make(Args &&...args)
+    {
+        return counted_ptr(new counted_block<T>(std::forward<Args>(args)...));
+    }
+
+    void reset()
+    {
+        counted_block<T>::adjust(std::exchange(_M_block, nullptr), -1);
+    }
+
+    T *get() const
+    {
+        return _M_block ? &_M_block->_M_value : nullptr;
+    }
+
+    T &operator*() const
+    {
+        return _M_block->_M_value;
+    }
+
+    T *operator->() const
+    {
+        return get();
+    }
+
+    explicit operator bool() const
+    {
+        return _M_block != nullptr;
+    }
+
+    bool operator==(const counted_ptr &other) const
+    {
+        return _M_block == other._M_block;
+    }
+
+    bool operator!=(const counted_ptr &other) const
+    {
+        return _M_block != other._M_block;
+    }
+
+  private:
+    template <typename U> friend class atomic_counted_ptr;
+
+    explicit counted_ptr(counted_block<T> *block) : _M_block(block)
+    {
+    }
+
+    counted_block<T> *_M_block = nullptr;
+};
+
+template <typename T, typename... Args> counted_ptr<T> make_counted(Args &&...args)
+{
+    return counted_ptr<T>::make(std::forward<Args>(args)...);
+}
+
+/*
+   Lock free atomic counted_ptr with split reference counts. The block
+   pointer and an external count share one wide_word: load bumps the
+   external count with a double width CAS, so the block cannot go away
+   under it, takes a reference on the internal count and then hands the
+   external unit back. When the pointer was replaced in between the unit
+   is no longer there to give back, the writer that replaced it added the
+   whole external count to the internal count, and the reader drops one
+   internal reference instead. The installed pointer holds one internal
+   reference of its own. Writers load the current pointer first, so a
+   store costs a load more than a plain exchange.
+*/
+template <typename T> class atomic_counted_ptr
+{
+  public:
+    using block_type = counted_block<T>;
+
+    atomic_counted_ptr() = default;
+
+    explicit atomic_counted_ptr(counted_ptr<T> desired) : _M_word{to_word(std::exchange(desired._M_block, nullptr)), 0}
+    {
+    }
+
+    atomic_counted_ptr(const atomic_counted_ptr &) = delete;
+    atomic_counted_ptr &operator=(const atomic_counted_ptr &) = delete;
+
+    ~atomic_counted_ptr()
+    {
+        block_type::adjust(block(_M_word), static_cast<std::int64_t>(_M_word._M_high) - 1);
+    }
+
+    counted_ptr<T> load()
+    {
+        auto current = snapshot();
+        wide_word desired;
+        do
+        {
+            if (current._M_low == 0)
+            {
+                return counted_ptr<T>();
+            }
+            desired = {current._M_low, current._M_high + 1};
+        } while (!wide_compare_exchange(_M_word, current, desired));
+
+        auto loaded = block(desired);
+        loaded->_M_count.fetch_add(1);
+        // gives the external unit back, or the internal one when the pointer moved on
+        current = desired;
+        while (true)
+        {
+            if (current._M_low != desired._M_low || current._M_high == 0)
+            {
+                block_type::adjust(loaded, -1);
+                break;
+            }
+            if (wide_compare_exchange(_M_word, current, wide_word{current._M_low, current._M_high - 1}))
+            {
+                break;
+            }
+        }
+        return counted_ptr<T>(loaded);
+    }
+
+    void store(counted_ptr<T> desired)
+    {
+        exchange(std::move(desired));
+    }
+
+    counted_ptr<T> exchange(counted_ptr<T> desired)
+    {
+        const wide_word next{to_word(desired._M_block), 0};
+        while (true)
+        {
+            auto previous = load();
+            if (install(previous, next))
+            {
+                desired._M_block = nullptr;
+                // the reference of the atomic goes to the returned pointer
+                return counted_ptr<T>(previous._M_block);
+            }
+        }
+    }
+
+    // compares the pointers, on failure expected receives the current value
+    bool compare_exchange_strong(counted_ptr<T> &expected, counted_ptr<T> desired)
+    {
+        if (install(expected, {to_word(desired._M_block), 0}))
+        {
+            desired._M_block = nullptr;
+            block_type::adjust(expected._M_block, -1);
+            return true;
+        }
+        expected = load();
+        return false;
+    }
+
+  private:
+    // bigger than any number of loads in flight on one block
+    constexpr static std::int64_t PIN = std::int64_t(1) << 40;
+
+    /*
+       Replaces the word while it still holds the block of expected. A
+       reader that lost its external unit drops an internal reference,
+       possibly before the external count is added, so the block is pinned
+       across the swap: expected keeps it alive for the pin itself.
+       On success the reference of the atomic is left on the block.
+    */
+    bool install(const counted_ptr<T> &expected, const wide_word &next)
+    {
+        const auto target = expected._M_block;
+        block_type::adjust(target, PIN);
+        auto current = snapshot();
+        while (block(current) == target)
+        {
+            if (wide_compare_exchange(_M_word, current, next))
+            {
+                block_type::adjust(target, static_cast<std::int64_t>(current._M_high) - PIN);
+                return true;
+            }
+        }
+        block_type::adjust(target, -PIN);
+        return false;
+    }
+
+    static std::uint64_t to_word(block_type *ptr)
+    {
+        return static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(ptr));
+    }
+
+    static block_type *block(const wide_word &word)
+    {
+        return reinterpret_cast<block_type *>(static_cast<std::uintptr_t>(word._M_low));
+    }
+
+    // may be torn, only used as the expected value of a CAS
+    wide_word snapshot() const
+    {
+        return {load_word(_M_word._M_low), load_word(_M_word._M_high)};
+    }
+
+    wide_word _M_word{0, 0};
+};
+
+/*
+   Epoch based reclamation. A thread enters the domain before touching shared
+   nodes and leaves it when done; unlinked nodes are retired instead of freed
+   and only reclaimed once the global epoch moved two steps past the epoch in
+   which they were retired, at that point no thread can still hold them.
+*/
+class EpochDomain
+{
+  public:
+    using reclaim_func = void (*)(void *);
+
+    static EpochDomain &instance()
+    {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    void enter()
+    {
+        auto rec = local();
+        if (rec->_M_nesting++ == 0)
+        {
+            // seq_cst, the announcement must be visible before any node is read
+            rec->_M_state.store((_M_epoch.load() << 1) | ACTIVE);
+        }
+    }
+
+    void exit()
+    {
+        auto rec = local();
+        if (--rec->_M_nesting == 0)
+        {
+            rec->_M_state.store(0, std::memory_order_release);
+        }
+    }
+
+    void retire(void *ptr, reclaim_func reclaim)
+    {
+        auto rec = local();
+        auto epoch = _M_epoch.load();
+        auto &bag = rec->_M_bags[epoch % 3];
+        if (bag._M_epoch != epoch)
+        {
+            // the bag still holds nodes from three epochs ago
+            free_bag(bag);
+            bag._M_epoch = epoch;
+        }
+        bag._M_nodes.emplace_back(ptr, reclaim);
+        _M_pending.fetch_add(1, std::memory_order_relaxed);
+        if (++rec->_M_retired % COLLECT_PERIOD == 0)
+        {
+            collect(rec);
+        }
+    }
+
+    template <typename T> void retire(T *ptr)
+    {
+        retire(ptr, [](void *p) { delete static_cast<T *>(p); });
+    }
+
+    void collect()
+    {
+        collect(local());
+    }
+
+    std::size_t pending() const
+    {
+        return _M_pending.load(std::memory_order_relaxed);
+    }
+
+    EpochDomain(const EpochDomain &) = delete;
+    EpochDomain &operator=(const EpochDomain &) = delete;
+
+    ~EpochDomain()
+    {
+        auto rec = _M_records.load();
+        while (rec)
+        {
+            auto next = rec->_M_next;
+            for (auto &bag : rec->_M_bags)
+            {
+                free_bag(bag);
+            }
+            delete rec;
+            rec = next;
+        }
+    }
+
+  private:
+    constexpr static std::uint64_t ACTIVE = 0x1;
+    constexpr static std::uint64_t COLLECT_PERIOD = 64;
+
+    struct Bag
+    {
+        std::uint64_t _M_epoch = 0;
+        std::vector<std::pair<void *, reclaim_func>> _M_nodes;
+    };
+
+    struct Record
+    {
+        std::atomic<std::uint64_t> _M_state = 0;
+        std::atomic<bool> _M_in_use = true;
+        std::uint64_t _M_nesting = 0;
+        std::uint64_t _M_retired = 0;
+        Bag _M_bags[3];
+        Record *_M_next = nullptr;
+    };
+
+    // gives the record back to the domain when the owner thread exits
+    struct Handle
+    {
+        Record *_M_record = nullptr;
+
+        ~Handle()
+        {
+            if (_M_record)
+            {
+                EpochDomain::instance().collect(_M_record);
+                _M_record->_M_state.store(0);
+                _M_record->_M_in_use.store(false);
+            }
+        }
+    };
+
+    EpochDomain() = default;
+
+    Record *local()
+    {
+        thread_local Handle handle;
+        if (handle._M_record == nullptr)
+        {
+            handle._M_record = acquire_record();
+        }
+        return handle._M_record;
+    }
+
+    Record *acquire_record()
+    {
+        for (auto rec = _M_records.load(); rec; rec = rec->_M_next)
+        {
+            bool expected = false;
+            if (!rec->_M_in_use.load() && rec->_M_in_use.compare_exchange_strong(expected, true))
+            {
+                return rec;
+            }
+        }
+        auto rec = new Record();
+        rec->_M_next = _M_records.load();
+        while (!_M_records.compare_exchange_weak(rec->_M_next, rec))
+        {
+        }
+        return rec;
+    }
+
+    // the epoch moves on only when every active thread already observed it
+    bool try_advance()
+    {
+        auto epoch = _M_epoch.load();
+        for (auto rec = _M_records.load(); rec; rec = rec->_M_next)
+        {
+            auto state = rec->_M_state.load();
+            if ((state & ACTIVE) && (state >> 1) != epoch)
+            {
+                return false;
+            }
+        }
+        return _M_epoch.compare_exchange_strong(epoch, epoch + 1);
+    }
+
+    void collect(Record *rec)
+    {
+        try_advance();
+        auto epoch = _M_epoch.load();
+        for (auto &bag : rec->_M_bags)
+        {
+            if (bag._M_epoch + 2 <= epoch)
+            {
+                free_bag(bag);
+            }
+        }
+    }
+
+    void free_bag(Bag &bag)
+    {
+        for (auto &node : bag._M_nodes)
+        {
+            node.second(node.first);
+        }
+        _M_pending.fetch_sub(bag._M_nodes.size(), std::memory_order_relaxed);
+        bag._M_nodes.clear();
+    }
+
+    std::atomic<std::uint64_t> _M_epoch = 0;
+    std::atomic<std::size_t> _M_pending = 0;
+    std::atomic<Record *> _M_records = nullptr;
+};
+
+class EpochGuard
+{
+  public:
+    EpochGuard()
+    {
+        EpochDomain::instance().enter();
+    }
+
+    ~EpochGuard()
+    {
+        EpochDomain::instance().exit();
+    }
+
+    EpochGuard(const EpochGuard &) = delete;
+    EpochGuard &operator=(const EpochGuard &) = delete;
+};
+
+/*
+   Hazard pointers. A reader publishes the pointer it is about to use in one
+   of its slots, a retired object is only freed by a scan that finds it in no
+   slot. Unlike epochs a stalled reader pins at most the objects it published,
+   so the garbage of a thread stays bounded by the number of slots. A thread
+   holding more than SLOTS hazard pointers at once chains SLOTS more.
+*/
+class HazardDomain
+{
+  public:
+    using reclaim_func = void (*)(void *);
+    constexpr static std::size_t SLOTS = 4;
+
+    static HazardDomain &instance()
+    {
+        static HazardDomain domain;
+        return domain;
+    }
+
+    std::atomic<void *> *acquire_slot()
+    {
+        auto block = &local()->_M_block;
+        while (true)
+        {
+            for (std::size_t i = 0; i < SLOTS; ++i)
+            {
+                if (!block->_M_used[i])
+                {
+                    block->_M_used[i] = true;
+                    return &block->_M_slots[i];
+                }
+            }
+            auto next = block->_M_next.load(std::memory_order_relaxed);
+            if (next == nullptr)
+            {
+                // only the owner appends, scans follow the link without it
+                next = new Block();
+                block->_M_next.store(next, std::memory_order_release);
+                _M_slot_count.fetch_add(SLOTS, std::memory_order_relaxed);
+            }
+            block = next;
+        }
+    }
+
+    void release_slot(std::atomic<void *> *slot)
+    {
+        slot->store(nullptr, std::memory_order_release);
+        for (auto block = &local()->_M_block; block; block = block->_M_next.load(std::memory_order_relaxed))
+        {
+            for (std::size_t i = 0; i < SLOTS; ++i)
+            {
+                if (&block->_M_slots[i] == slot)
+                {
+                    block->_M_used[i] = false;
+                    return;
+                }
+            }
+        }
+    }
+
+    void retire(void *ptr, reclaim_func reclaim)
+    {
+        auto rec = local();
+        rec->_M_retired.emplace_back(ptr, reclaim);
+        _M_pending.fetch_add(1, std::memory_order_relaxed);
+        if (rec->_M_retired.size() >= threshold())
+        {
+            scan(rec);
+        }
+    }
+
+    template <typename T> void retire(T *ptr)
+    {
+        retire(ptr, [](void *p) { delete static_cast<T *>(p); });
+    }
+
+    void scan()
+    {
+        scan(local());
+    }
+
+    std::size_t pending() const
+    {
+        return _M_pending.load(std::memory_order_relaxed);
+    }
+
+    HazardDomain(const HazardDomain &) = delete;
+    HazardDomain &operator=(const HazardDomain &) = delete;
+
+    ~HazardDomain()
+    {
+        auto rec = _M_records.load();
+        while (rec)
+        {
+            auto next = rec->_M_next;
+            for (auto &node : rec->_M_retired)
+            {
+                node.second(node.first);
+            }
+            auto block = rec->_M_block._M_next.load();
+            while (block)
+            {
+                auto following = block->_M_next.load();
+                delete block;
+                block = following;
+            }
+            delete rec;
+            rec = next;
+        }
+    }
+
+  private:
+    struct Block
+    {
+        std::atomic<void *> _M_slots[SLOTS] = {};
+        bool _M_used[SLOTS] = {};
+        std::atomic<Block *> _M_next = nullptr;
+    };
+
+    struct Record
+    {
+        Block _M_block;
+        std::atomic<bool> _M_in_use = true;
+        std::vector<std::pair<void *, reclaim_func>> _M_retired;
+        Record *_M_next = nullptr;
+    };
+
+    struct Handle
+    {
+        Record *_M_record = nullptr;
+
+        ~Handle()
+        {
+            if (_M_record)
+            {
+                HazardDomain::instance().scan(_M_record);
+                _M_record->_M_in_use.store(false);
+            }
+        }
+    };
+
+    HazardDomain() = default;
+
+    Record *local()
+    {
+        thread_local Handle handle;
+        if (handle._M_record == nullptr)
+        {
+            handle._M_record = acquire_record();
+        }
+        return handle._M_record;
+    }
+
+    Record *acquire_record()
+    {
+        for (auto rec = _M_records.load(); rec; rec = rec->_M_next)
+        {
+            bool expected = false;
+            if (!rec->_M_in_use.load() && rec->_M_in_use.compare_exchange_strong(expected, true))
+            {
+                return rec;
+            }
+        }
+        auto rec = new Record();
+        rec->_M_next = _M_records.load();
+        while (!_M_records.compare_exchange_weak(rec->_M_next, rec))
+        {
+        }
+        _M_slot_count.fetch_add(SLOTS);
+        return rec;
+    }
+
+    // scanning once per O(slots) retires keeps the cost amortized constant
+    std::size_t threshold() const
+    {
+        return std::max<std::size_t>(64, 2 * _M_slot_count.load(std::memory_order_relaxed));
+    }
+
+    void scan(Record *rec)
+    {
+        std::vector<void *> hazards;
+        for (auto other = _M_records.load(); other; other = other->_M_next)
+        {
+            for (auto block = &other->_M_block; block; block = block->_M_next.load(std::memory_order_acquire))
+            {
+                for (auto &slot : block->_M_slots)
+                {
+                    if (auto ptr = slot.load())
+                    {
+                        hazards.push_back(ptr);
+                    }
+                }
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        std::size_t kept = 0;
+        for (auto &node : rec->_M_retired)
+        {
+            if (std::binary_search(hazards.begin(), hazards.end(), node.first))
+            {
+                rec->_M_retired[kept++] = node;
+            }
+            else
+            {
+                node.second(node.first);
+            }
+        }
+        _M_pending.fetch_sub(rec->_M_retired.size() - kept, std::memory_order_relaxed);
+        rec->_M_retired.resize(kept);
+    }
+
+    std::atomic<std::size_t> _M_pending = 0;
+    // slots of every record, extra blocks included
+    std::atomic<std::size_t> _M_slot_count = 0;
+    std::atomic<Record *> _M_records = nullptr;
+};
+
+class HazardPointer
+{
+  public:
+    HazardPointer() : _M_slot(HazardDomain::instance().acquire_slot())
+    {
+    }
+
+    ~HazardPointer()
+    {
+        HazardDomain::instance().release_slot(_M_slot);
+    }
+
+    /*
+       Publishes the value of src and re-reads it until both agree, the
+       returned pointer stays valid until reset or the next protect. Tag bits
+       in mask are stripped before publishing.
+    */
+    template <typename T> T *protect(const std::atomic<T *> &src, std::uintptr_t mask = 0)
+    {
+        auto ptr = src.load();
+        while (true)
+        {
+            _M_slot->store(reinterpret_cast<void *>(reinterpret_cast<std::uintptr_t>(ptr) & ~mask));
+            auto again = src.load();
+            if (again == ptr)
+            {
+                return ptr;
+            }
+            ptr = again;
+        }
+    }
+
+    void reset()
+    {
+        _M_slot->store(nullptr, std::memory_order_release);
+    }
+
+    HazardPointer(const HazardPointer &) = delete;
+    HazardPointer &operator=(const HazardPointer &) = delete;
+
+  private:
+    std::atomic<void *> *_M_slot;
+};
+
+/*
+   Fixed size block pool for the nodes of the lock free containers. A thread
+   allocates from and frees to its own magazine (a chain of blocks), when it
+   holds two magazines worth of blocks the older one goes to a shared depot
+   and an empty thread refills from the depot before carving a new chunk, so
+   a node freed by another thread flows back to the pool instead of malloc.
+
+   The depot is a lock free stack of magazines, its head carries a version
+   in the bits above the pointer so a pop racing with a pop and push of the
+   same magazine fails its CAS. Chunks are never returned to the system, a
+   stale read of a popped magazine stays inside mapped memory.
+*/
+template <std::size_t Size, std::size_t Align> class NodePool
+{
+  public:
+    constexpr static std::size_t MAGAZINE = 64;
+
+    static NodePool &instance()
+    {
+        // never destroyed, static destructors may still free nodes
+        static NodePool *pool = new NodePool();
+        return *pool;
+    }
+
+    void *allocate()
+    {
+        auto &cache = local();
+        if (cache._M_blocks == nullptr)
+        {
+            refill(cache);
+        }
+        auto block = cache._M_blocks;
+        cache._M_blocks = block->_M_next;
+        --cache._M_count;
+        return block;
+    }
+
+    void deallocate(void *ptr)
+    {
+        auto &cache = local();
+        auto block = static_cast<Block *>(ptr);
+        if (!cache._M_alive)
+        {
+            // the thread already flushed its magazine on exit
+            block->_M_next = nullptr;
+            block->_M_count = 1;
+            push(block);
+            return;
+        }
+        block->_M_next = cache._M_blocks;
+        cache._M_blocks = block;
+        if (++cache._M_count == 2 * MAGAZINE)
+        {
+            auto last = block;
+            for (std::size_t i = 1; i < MAGAZINE; ++i)
+            {
+                last = last->_M_next;
+            }
+            cache._M_blocks = last->_M_next;
+            cache._M_count -= MAGAZINE;
+            last->_M_next = nullptr;
+            block->_M_count = MAGAZINE;
+            push(block);
+        }
+    }
+
+    NodePool(const NodePool &) = delete;
+    NodePool &operator=(const NodePool &) = delete;
+
+  private:
+    // a free block, the first block of a magazine also links the depot and holds its length
+    struct Block
+    {
+        Block *_M_next;
+        Block *_M_magazine;
+        std::size_t _M_count;
+    };
+
+    constexpr static std::size_t ALIGN = Align > alignof(Block) ? Align : alignof(Block);
+    constexpr static std::size_t BLOCK = ((Size > sizeof(Block) ? Size : sizeof(Block)) + ALIGN - 1) / ALIGN * ALIGN;
+
+    // trivially destructible so it can still be read after the thread flushed it
+    struct Cache
+    {
+        Block *_M_blocks;
+        std::size_t _M_count;
+        bool _M_alive;
+    };
+
+    // hands the magazine of an exiting thread to the depot
+    struct Flusher
+    {
+        Cache *_M_cache;
+
+        ~Flusher()
+        {
+            if (_M_cache->_M_blocks)
+            {
+                _M_cache->_M_blocks->_M_count = _M_cache->_M_count;
+                NodePool::instance().push(_M_cache->_M_blocks);
+            }
+            _M_cache->_M_blocks = nullptr;
+            _M_cache->_M_count = 0;
+            _M_cache->_M_alive = false;
+        }
+    };
+
+    NodePool() = default;
+
+    static Cache &local()
+    {
+        static thread_local Cache cache = {nullptr, 0, true};
+        static thread_local Flusher flusher = {&cache};
+        (void)flusher;
+        return cache;
+    }
+
+    // user space addresses fit in 48 bits on x86-64 and AArch64
+    constexpr static unsigned VERSION_SHIFT = sizeof(void *) == 4 ? 32 : 48;
+    constexpr static std::uint64_t POINTER_MASK = (std::uint64_t(1) << VERSION_SHIFT) - 1;
+
+    static Block *pointer(std::uint64_t head)
+    {
+        return reinterpret_cast<Block *>(static_cast<std::uintptr_t>(head & POINTER_MASK));
+    }
+
+    static std::uint64_t next_head(std::uint64_t head, Block *block)
+    {
+        const auto version = (head >> VERSION_SHIFT) + 1;
+        return static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(block)) | (version << VERSION_SHIFT);
+    }
+
+    void push(Block *magazine)
+    {
+        auto head = _M_depot.load();
+        do
+        {
+            magazine->_M_magazine = pointer(head);
+        } while (!_M_depot.compare_exchange_weak(head, next_head(head, magazine)));
+    }
+
+    Block *pop()
+    {
+        auto head = _M_depot.load();
+        while (pointer(head))
+        {
+            // may read a magazine that was popped meanwhile, the version makes the CAS fail
+            auto next = pointer(head)->_M_magazine;
+            if (_M_depot.compare_exchange_weak(head, next_head(head, next)))
+            {
+                return pointer(head);
+            }
+        }
+        return nullptr;
+    }
+
+    void refill(Cache &cache)
+    {
+        if (auto magazine = pop())
+        {
+            cache._M_blocks = magazine;
+            cache._M_count = magazine->_M_count;
+            return;
+        }
+        // the first block of a chunk links the chunks, it keeps them reachable
+        auto chunk = static_cast<char *>(::operator new(BLOCK * (MAGAZINE + 1), std::align_val_t(ALIGN)));
+        auto header = reinterpret_cast<Block *>(chunk);
+        header->_M_next = _M_chunks.load();
+        while (!_M_chunks.compare_exchange_weak(header->_M_next, header))
+        {
+        }
+        Block *blocks = nullptr;
+        for (std::size_t i = MAGAZINE; i > 0; --i)
+        {
+            auto block = reinterpret_cast<Block *>(chunk + i * BLOCK);
+            block->_M_next = blocks;
+            blocks = block;
+        }
+        cache._M_blocks = blocks;
+        cache._M_count = MAGAZINE;
+    }
+
+    std::atomic<std::uint64_t> _M_depot = 0;
+    std::atomic<Block *> _M_chunks = nullptr;
+};
+
+/*
+   Allocator over NodePool, single objects come from the pool of their size
+   and arrays from std::allocator. Plugs in as the Allocator of lf::set and
+   lf::HashTable, their nodes are rebound to the pool of the node size.
+*/
+template <typename T> struct pool_allocator
+{
+    using value_type = T;
+
+    pool_allocator() = default;
+
+    template <typename U> pool_allocator(const pool_allocator<U> &)
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        if (n == 1)
+        {
+            return static_cast<T *>(NodePool<sizeof(T), alignof(T)>::instance().allocate());
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *ptr, std::size_t n)
+    {
+        if (n == 1)
+        {
+            NodePool<sizeof(T), alignof(T)>::instance().deallocate(ptr);
+            return;
+        }
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <typename U> bool operator==(const pool_allocator<U> &) const
+    {
+        return true;
+    }
+
+    template <typename U> bool operator!=(const pool_allocator<U> &) const
+    {
+        return false;
+    }
+};
+
+/*
+   Size class slab allocator shared by every node type. A request of up to
+   MAX_SIZE bytes is rounded to one of CLASSES sizes (16 byte steps up to
+   128, then four steps per doubling) and served from a SLAB aligned slab
+   of that class. Every slab belongs to one thread heap: its owner pops and
+   pushes the local free list without atomics, any other thread pushes the
+   block on the remote list of the slab and the owner takes the whole list
+   with one exchange once the local list runs dry, so a block always goes
+   back to the slab it came from. The slabs of an exiting thread are
+   abandoned and adopted by the next heap that runs out of that class.
+   Slabs are kept for reuse, the memory is not returned to the system.
+*/
+class SlabPool
+{
+  public:
+    constexpr static std::size_t SLAB = std::size_t(1) << 16;
+    constexpr static std::size_t MAX_SIZE = 1024;
+    constexpr static std::size_t ALIGN = 16;
+    constexpr static std::size_t CLASSES = 20;
+
+    static SlabPool &instance()
+    {
+        // never destroyed, static destructors may still free blocks
+        static SlabPool *pool = new SlabPool();
+        return *pool;
+    }
+
+    static constexpr std::size_t size_class(std::size_t bytes)
+    {
+        if (bytes <= 128)
+        {
+            return bytes == 0 ? 0 : (bytes - 1) / 16;
+        }
+        std::size_t shift = 7;
+        while ((std::size_t(2) << shift) < bytes)
+        {
+            ++shift;
+        }
+        return 8 + (shift - 7) * 4 + (bytes - (std::size_t(1) << shift) - 1) / (std::size_t(1) << (shift - 2));
+    }
+
+    static constexpr std::size_t class_size(std::size_t size_class)
+    {
+        if (size_class < 8)
+        {
+            return (size_class + 1) * 16;
+        }
+        const auto shift = 7 + (size_class - 8) / 4;
+        return (std::size_t(1) << shift) + ((size_class - 8) % 4 + 1) * (std::size_t(1) << (shift - 2));
+    }
+
+    void *allocate(std::size_t bytes)
+    {
+        assert(bytes <= MAX_SIZE);
+        auto &heap = local();
+        if (!heap._M_alive)
+        {
+            // thread local destructors of an exiting thread share one heap
+            std::lock_guard<std::mutex> lock(_M_mutex);
+            return take(_M_orphan, size_class(bytes));
+        }
+        return take(heap, size_class(bytes));
+    }
+
+    void deallocate(void *ptr)
+    {
+        auto slab = slab_of(ptr);
+        auto block = static_cast<Block *>(ptr);
+        auto &heap = local();
+        if (heap._M_alive)
+        {
+            if (slab->_M_owner.load(std::memory_order_relaxed) == &heap)
+            {
+                block->_M_next = slab->_M_local;
+                slab->_M_local = block;
+                return;
+            }
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(_M_mutex);
+            if (slab->_M_owner.load(std::memory_order_relaxed) == &_M_orphan)
+            {
+                block->_M_next = slab->_M_local;
+                slab->_M_local = block;
+                return;
+            }
+        }
+        auto head = slab->_M_remote.load(std::memory_order_relaxed);
+        do
+        {
+            block->_M_next = head;
+        } while (!slab->_M_remote.compare_exchange_weak(head, block, std::memory_order_release,
+                                                        std::memory_order_relaxed));
+    }
+
+    SlabPool(const SlabPool &) = delete;
+    SlabPool &operator=(const SlabPool &) = delete;
+
+  private:
+    struct Block
+    {
+        Block *_M_next;
+    };
+
+    struct Heap;
+
+    // header at the start of every slab, the blocks follow it
+    struct Slab
+    {
+        std::atomic<Heap *> _M_owner;
+        // next slab of the owner, or of the abandoned list
+        Slab *_M_next;
+        Block *_M_local;
+        // blocks never handed out yet
+        char *_M_bump;
+        char *_M_end;
+        std::size_t _M_size;
+        // on its own cache line, written by the other threads
+        alignas(64) std::atomic<Block *> _M_remote;
+
+        void *pop()
+        {
+            if (_M_local == nullptr && _M_remote.load(std::memory_order_relaxed))
+            {
+                _M_local = _M_remote.exchange(nullptr, std::memory_order_acquire);
+            }
+            if (auto block = _M_local)
+            {
+                _M_local = block->_M_next;
+                return block;
+            }
+            if (_M_bump != _M_end)
+            {
+                auto block = _M_bump;
+                _M_bump += _M_size;
+                return block;
+            }
+            return nullptr;
+        }
+    };
+
+    // trivially destructible so it can still be read after the thread abandoned it
+    struct Heap
+    {
+        Slab *_M_current[CLASSES];
+        Slab *_M_slabs[CLASSES];
+        bool _M_alive;
+    };
+
+    // hands the slabs of an exiting thread to the abandoned lists
+    struct Reaper
+    {
+        Heap *_M_heap;
+
+        ~Reaper()
+        {
+            SlabPool::instance().abandon(*_M_heap);
+        }
+    };
+
+    SlabPool() = default;
+
+    static Heap &local()
+    {
+        static thread_local Heap heap = {{}, {}, true};
+        static thread_local Reaper reaper = {&heap};
+        (void)reaper;
+        return heap;
+    }
+
+    static Slab *slab_of(void *ptr)
+    {
+        return reinterpret_cast<Slab *>(reinterpret_cast<std::uintptr_t>(ptr) & ~(SLAB - 1));
+    }
+
+    void *take(Heap &heap, std::size_t size_class)
+    {
+        if (auto slab = heap._M_current[size_class])
+        {
+            if (auto block = slab->pop())
+            {
+                return block;
+            }
+        }
+        for (auto slab = heap._M_slabs[size_class]; slab; slab = slab->_M_next)
+        {
+            if (auto block = slab->pop())
+            {
+                heap._M_current[size_class] = slab;
+                return block;
+            }
+        }
+        while (true)
+        {
+            auto slab = adopt(size_class);
+            if (slab == nullptr)
+            {
+                slab = create(size_class);
+            }
+            slab->_M_owner.store(&heap, std::memory_order_relaxed);
+            slab->_M_next = heap._M_slabs[size_class];
+            heap._M_slabs[size_class] = slab;
+            heap._M_current[size_class] = slab;
+            if (auto block = slab->pop())
+            {
+                return block;
+            }
+        }
+    }
+
+    static Slab *create(std::size_t size_class)
+    {
+        constexpr auto header = (sizeof(Slab) + ALIGN - 1) / ALIGN * ALIGN;
+        auto memory = static_cast<char *>(::operator new(SLAB, std::align_val_t(SLAB)));
+        auto slab = ::new (memory) Slab();
+        slab->_M_size = class_size(size_class);
+        slab->_M_bump = memory + header;
+        slab->_M_end = slab->_M_bump + (SLAB - header) / slab->_M_size * slab->_M_size;
+        return slab;
+    }
+
+    Slab *adopt(std::size_t size_class)
+    {
+        std::lock_guard<std::mutex> lock(_M_mutex);
+        auto slab = _M_abandoned[size_class];
+        if (slab)
+        {
+            _M_abandoned[size_class] = slab->_M_next;
+        }
+        return slab;
+    }
+
+    void abandon(Heap &heap)
+    {
+        std::lock_guard<std::mutex> lock(_M_mutex);
+        for (std::size_t size_class = 0; size_class < CLASSES; ++size_class)
+        {
+            auto slab = heap._M_slabs[size_class];
+            while (slab)
+            {
+                auto next = slab->_M_next;
+                slab->_M_owner.store(nullptr, std::memory_order_relaxed);
+                slab->_M_next = _M_abandoned[size_class];
+                _M_abandoned[size_class] = slab;
+                slab = next;
+            }
+            heap._M_slabs[size_class] = nullptr;
+            heap._M_current[size_class] = nullptr;
+        }
+        heap._M_alive = false;
+    }
+
+    std::mutex _M_mutex;
+    Heap _M_orphan = {{}, {}, true};
+    Slab *_M_abandoned[CLASSES] = {};
+};
+
+/*
+   Allocator over SlabPool for any container: allocate(n) of up to
+   SlabPool::MAX_SIZE bytes comes from the slab of its size class, bigger
+   or over aligned requests go to std::allocator. Rebinding keeps the pool,
+   so the nodes of List, lf::list, lf::set and the tables of VecTable share
+   the slabs of their sizes.
+*/
+template <typename T> struct slab_allocator
+{
+    using value_type = T;
+
+    slab_allocator() = default;
+
+    template <typename U> slab_allocator(const slab_allocator<U> &)
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        if (pooled(n))
+        {
+            return static_cast<T *>(SlabPool::instance().allocate(n * sizeof(T)));
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *ptr, std::size_t n)
+    {
+        if (pooled(n))
+        {
+            SlabPool::instance().deallocate(ptr);
+            return;
+        }
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <typename U> bool operator==(const slab_allocator<U> &) const
+    {
+        return true;
+    }
+
+    template <typename U> bool operator!=(const slab_allocator<U> &) const
+    {
+        return false;
+    }
+
+  private:
+    static bool pooled(std::size_t n)
+    {
+        return alignof(T) <= SlabPool::ALIGN && n <= SlabPool::MAX_SIZE / sizeof(T);
+    }
+};
+
+/*
+   Bump pointer arena for containers that are built, queried and thrown
+   away. Allocations are carved from blocks that double in size, freeing
+   a single allocation does nothing and release() returns every block at
+   once without running any destructor. The arena must outlive whatever
+   allocated from it, and it is not thread safe.
+*/
+class MonotonicArena
+{
+  public:
+    explicit MonotonicArena(std::size_t initial = 4096) : _M_initial(initial), _M_next_size(initial)
+    {
+    }
+
+    ~MonotonicArena()
+    {
+        release();
+    }
+
+    MonotonicArena(const MonotonicArena &) = delete;
+    MonotonicArena &operator=(const MonotonicArena &) = delete;
+
+    void *allocate(std::size_t bytes, std::size_t align)
+    {
+        const auto at = (_M_cursor + align - 1) & ~(std::uintptr_t(align) - 1);
+        if (at + bytes > _M_end || _M_end == 0)
+        {
+            return grow(bytes, align);
+        }
+        _M_cursor = at + bytes;
+        return reinterpret_cast<void *>(at);
+    }
+
+    void release()
+    {
+        while (_M_blocks)
+        {
+            auto next = _M_blocks->_M_next;
+            ::operator delete(_M_blocks);
+            _M_blocks = next;
+        }
+        _M_cursor = 0;
+        _M_end = 0;
+        _M_reserved = 0;
+        _M_next_size = _M_initial;
+    }
+
+    // bytes taken from the system, headers included
+    std::size_t reserved() const
+    {
+        return _M_reserved;
+    }
+
+  private:
+    struct alignas(std::max_align_t) Block
+    {
+        Block *_M_next;
+    };
+
+    void *grow(std::size_t bytes, std::size_t align)
+    {
+        auto size = _M_next_size;
+        while (size < sizeof(Block) + bytes + align)
+        {
+            size *= 2;
+        }
+        auto block = static_cast<Block *>(::operator new(size));
+        block->_M_next = _M_blocks;
+        _M_blocks = block;
+        _M_reserved += size;
+        _M_next_size = size * 2;
+        _M_cursor = reinterpret_cast<std::uintptr_t>(block + 1);
+        _M_end = reinterpret_cast<std::uintptr_t>(block) + size;
+        return allocate(bytes, align);
+    }
+
+    const std::size_t _M_initial;
+    std::size_t _M_next_size;
+    std::size_t _M_reserved = 0;
+    std::uintptr_t _M_cursor = 0;
+    std::uintptr_t _M_end = 0;
+    Block *_M_blocks = nullptr;
+};
+
+/*
+   Allocator over a MonotonicArena, deallocate is a no-op. Every rebound
+   copy allocates from the same arena, so a tree or a list bound to it is
+   freed by releasing the arena.
+*/
+template <typename T> struct arena_allocator
+{
+    using value_type = T;
+
+    explicit arena_allocator(MonotonicArena &arena) : _M_arena(&arena)
+    {
+    }
+
+    template <typename U> arena_allocator(const arena_allocator<U> &other) : _M_arena(other._M_arena)
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(_M_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, std::size_t)
+    {
+    }
+
+    template <typename U> bool operator==(const arena_allocator<U> &other) const
+    {
+        return _M_arena == other._M_arena;
+    }
+
+    template <typename U> bool operator!=(const arena_allocator<U> &other) const
+    {
+        return _M_arena != other._M_arena;
+    }
+
+    MonotonicArena *_M_arena;
+};
+
+enum class page_mode
+{
+    // madvise(MADV_HUGEPAGE), the kernel backs the range with huge pages when it can
+    transparent,
+    // MAP_HUGETLB from the reserved pool, transparent when the pool is empty
+    explicit_pages
+};
+
+/*
+   Allocator for big arrays such as the buckets of VecTable: an allocation
+   of at least HUGE_PAGE bytes is mapped on its own, aligned and rounded to
+   HUGE_PAGE, and backed with huge pages as Mode asks, so a random walk
+   over it touches one TLB entry per 2 MiB instead of one per 4 KiB.
+   Smaller allocations, and every allocation where mmap is not available,
+   go to std::allocator.
+*/
+template <typename T, page_mode Mode = page_mode::transparent> struct huge_page_allocator
+{
+    using value_type = T;
+
+    constexpr static std::size_t HUGE_PAGE = std::size_t(1) << 21;
+
+    template <typename U> struct rebind
+    {
+        using other = huge_page_allocator<U, Mode>;
+    };
+
+    huge_page_allocator() = default;
+
+    template <typename U> huge_page_allocator(const huge_page_allocator<U, Mode> &)
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+#ifdef MEMORY_HUGE_PAGES
+        if (mapped(n))
+        {
+            return static_cast<T *>(map(round(n * sizeof(T))));
+        }
+#endif
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *ptr, std::size_t n)
+    {
+#ifdef MEMORY_HUGE_PAGES
+        if (mapped(n))
+        {
+            ::munmap(ptr, round(n * sizeof(T)));
+            return;
+        }
+#endif
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <typename U> bool operator==(const huge_page_allocator<U, Mode> &) const
+    {
+        return true;
+    }
+
+    template <typename U> bool operator!=(const huge_page_allocator<U, Mode> &) const
+    {
+        return false;
+    }
+
+  private:
+#ifdef MEMORY_HUGE_PAGES
+    static bool mapped(std::size_t n)
+    {
+        return n >= HUGE_PAGE / sizeof(T) && n <= (std::numeric_limits<std::size_t>::max() - HUGE_PAGE) / sizeof(T);
+    }
+
+    static std::size_t round(std::size_t bytes)
+    {
+        return (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    }
+
+    static void *map(std::size_t bytes)
+    {
+        constexpr int protection = PROT_READ | PROT_WRITE;
+#ifdef MAP_HUGETLB
+        if (Mode == page_mode::explicit_pages)
+        {
+            auto pages = ::mmap(nullptr, bytes, protection, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (pages != MAP_FAILED)
+            {
+                return pages;
+            }
+        }
+#endif
+        // over mapped by one huge page and trimmed, so the range starts on a huge page boundary
+        auto raw = ::mmap(nullptr, bytes + HUGE_PAGE, protection, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+        const auto begin = reinterpret_cast<std::uintptr_t>(raw);
+        const auto aligned = (begin + HUGE_PAGE - 1) & ~std::uintptr_t(HUGE_PAGE - 1);
+        if (aligned != begin)
+        {
+            ::munmap(raw, aligned - begin);
+        }
+        ::munmap(reinterpret_cast<void *>(aligned + bytes), begin + HUGE_PAGE - aligned);
+#ifdef MADV_HUGEPAGE
+        ::madvise(reinterpret_cast<void *>(aligned), bytes, MADV_HUGEPAGE);
+#endif
+        return reinterpret_cast<void *>(aligned);
+    }
+#endif
+};
+
 } // namespace memory
 #endif
\ No newline at end of file
@@ -134,19 +134,26 @@ template <typename Node> struct Iterator
     node_sptr m_data;
 };
 
-template <typename Key, typename Value> class OrderStatisticRBtree
+template <typename Key, typename Value, typename Allocator = std::allocator<Pair<Key, Value>>> class OrderStatisticRBtree
 {
 
   public:
     using node_type = Node<Pair<Key, Value>>;
     using node_sptr = typename node_type::node_sptr;
     using iterator = Iterator<node_type>;
+    using allocator_type = Allocator;
 
     OrderStatisticRBtree()
     {
         init();
     }
 
+    // nodes come from allocator, with memory::arena_allocator dropping the tree is one arena release
+    explicit OrderStatisticRBtree(const Allocator &allocator) : m_allocator(allocator)
+    {
+        init();
+    }
+
     iterator begin()
     {
         if (m_root == m_nil)
@@ -197,7 +204,7 @@ template <typename Key, typename Value> class OrderStatisticRBtree
 
     void insert(const Key &key, const Value &val)
     {
-        auto node = std::make_shared<node_type>();
+        auto node = std::allocate_shared<node_type>(m_allocator);
         node->m_value.first = key;
         node->m_value.second = val;
         node->m_size = 1;
@@ -532,7 +539,7 @@ template <typename Key, typename Value> class OrderStatisticRBtree
 
     void init()
     {
-        m_nil = std::make_shared<node_type>();
+        m_nil = std::allocate_shared<node_type>(m_allocator);
         m_nil->m_color = Color::Black;
         m_nil->m_nil = true;
         m_nil->m_size = 0;
@@ -543,4 +550,5 @@ template <typename Key, typename Value> class OrderStatisticRBtree
     node_sptr m_root;
     node_sptr m_nil;
     size_t m_size;
+    Allocator m_allocator;
 };
@@ -133,21 +133,28 @@ struct Iterator
 };
 
 
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Allocator = std::allocator<Pair<Key, Value>>>
 class RedBlackTree
 {
 
   public:
 
-    using node_type = typename Node<Pair<Key, Value>>;
-    using node_sptr = node_type::node_sptr;
+    using node_type = Node<Pair<Key, Value>>;
+    using node_sptr = typename node_type::node_sptr;
     using iterator = Iterator<node_type>;
+    using allocator_type = Allocator;
 
     RedBlackTree()
     {
         init();
     }
 
+    // nodes come from allocator, with memory::arena_allocator dropping the tree is one arena release
+    explicit RedBlackTree(const Allocator& allocator) : m_allocator(allocator)
+    {
+        init();
+    }
+
     iterator begin()
     {
         if (m_root == m_nil)
@@ -172,7 +179,7 @@ class RedBlackTree
 
     void insert(const Key& key, const Value&& val)
     {
-        auto node = std::make_shared<node_type>();
+        auto node = std::allocate_shared<node_type>(m_allocator);
         node->m_value.first = key;
         node->m_value.second = val;
         _insert(node);
@@ -485,7 +492,7 @@ class RedBlackTree
 
     void init()
     {
-        m_nil = std::make_shared<node_type>();
+        m_nil = std::allocate_shared<node_type>(m_allocator);
         m_nil->m_color = Color::Black;
         m_nil->m_nil = true;
         m_root = m_nil;
@@ -493,6 +500,7 @@ class RedBlackTree
 
     node_sptr m_root;
     node_sptr m_nil;
+    Allocator m_allocator;
 };
 
 
@@ -1,6 +1,12 @@
 
 #include "gtest/gtest.h"
+#include "hash_table.hpp"
 #include "hash_table_lock_free.hpp"
+#include "hash_table_split_ordered.hpp"
+#include "hash_table_frozen.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
 #include <thread>
 #include <string>
 #include <vector>
@@ -19,6 +25,205 @@ TEST_F(HashTableTest, CreateHash)
 {
     EXPECT_EQ(0x00, _M_hash.size());
     _M_hash.insert({1, 1.0f});
+    EXPECT_EQ(0x01, _M_hash.size());
+    EXPECT_TRUE(_M_hash.find(1));
+    EXPECT_FALSE(_M_hash.find(2));
+}
+
+TEST(ChainingHashTableTest, GrowKeepsElements)
+{
+    lf::HashTable<int, int> table(1 << 4);
+    for (int i = 0; i < 100; ++i)
+    {
+        table.insert({i, i});
+    }
+    EXPECT_EQ(100, table.size());
+    EXPECT_LE(256, table.bucket_count());
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_TRUE(table.find(i));
+    }
+}
+
+class FlatHashTableTest : public testing::Test
+{
+  protected:
+    FlatHashTableTest() : _M_hash(1 << 4)
+    {
+    }
+
+    lf::FlatHashTable<int, int> _M_hash;
+};
+
+TEST_F(FlatHashTableTest, InsertFindErase)
+{
+    _M_hash.insert({1, 10});
+    _M_hash.insert({1, 20});
+    EXPECT_EQ(1, _M_hash.size());
+    EXPECT_TRUE(_M_hash.find(1));
+    EXPECT_TRUE(_M_hash.erase(1));
+    EXPECT_FALSE(_M_hash.erase(1));
+    EXPECT_FALSE(_M_hash.find(1));
+    EXPECT_EQ(0, _M_hash.size());
+    _M_hash.insert({1, 30});
+    EXPECT_TRUE(_M_hash.find(1));
+}
+
+TEST_F(FlatHashTableTest, GrowKeepsElements)
+{
+    for (int i = 0; i < 1000; ++i)
+    {
+        _M_hash.insert({i, i});
+    }
+    EXPECT_EQ(1000, _M_hash.size());
+    EXPECT_LE(2048, _M_hash.bucket_count());
+    for (int i = 0; i < 1000; ++i)
+    {
+        EXPECT_TRUE(_M_hash.find(i));
+    }
+    EXPECT_FALSE(_M_hash.find(1000));
+}
+
+TEST_F(FlatHashTableTest, TombstonesDoNotFillTheTable)
+{
+    for (int i = 0; i < 200000; ++i)
+    {
+        _M_hash.insert({i, i});
+        EXPECT_TRUE(_M_hash.erase(i));
+    }
+    EXPECT_EQ(0, _M_hash.size());
+    // the tombstones are dropped by rehashes at the same size
+    EXPECT_EQ(16, _M_hash.bucket_count());
+    _M_hash.insert({7, 7});
+    EXPECT_TRUE(_M_hash.find(7));
+}
+
+TEST_F(FlatHashTableTest, ChurnAroundLiveKeysStaysBounded)
+{
+    for (int i = 0; i < 1000; ++i)
+    {
+        _M_hash.insert({i, i});
+    }
+    const auto buckets = _M_hash.bucket_count();
+    for (int i = 1000; i < 201000; ++i)
+    {
+        _M_hash.insert({i, i});
+        EXPECT_TRUE(_M_hash.erase(i));
+    }
+    EXPECT_EQ(1000, _M_hash.size());
+    EXPECT_LE(_M_hash.bucket_count(), 2 * buckets);
+    for (int i = 0; i < 1000; ++i)
+    {
+        EXPECT_TRUE(_M_hash.find(i));
+    }
+}
+
+TEST_F(FlatHashTableTest, ConcurrentInsert)
+{
+    constexpr int threads = 4;
+    constexpr int per_thread = 5000;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([this, t]() {
+            for (int i = 0; i < per_thread; ++i)
+            {
+                // half of the keys are shared between the threads
+                _M_hash.insert({(i % 2) ? i : t * per_thread + i, i});
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    size_t expected = per_thread / 2 + threads * per_thread / 2;
+    EXPECT_EQ(expected, _M_hash.size());
+    for (int i = 1; i < per_thread; i += 2)
+    {
+        EXPECT_TRUE(_M_hash.find(i));
+    }
+}
+
+class SplitOrderedHashTableTest : public testing::Test
+{
+  protected:
+    SplitOrderedHashTableTest() : _M_hash(1 << 2)
+    {
+    }
+
+    lf::SplitOrderedHashTable<int, int> _M_hash;
+};
+
+TEST_F(SplitOrderedHashTableTest, InsertFindErase)
+{
+    EXPECT_TRUE(_M_hash.insert({1, 10}));
+    EXPECT_FALSE(_M_hash.insert({1, 20}));
+    EXPECT_EQ(1, _M_hash.size());
+    EXPECT_EQ(std::optional<int>(10), _M_hash.find(1));
+    EXPECT_TRUE(_M_hash.erase(1));
+    EXPECT_FALSE(_M_hash.erase(1));
+    EXPECT_FALSE(_M_hash.find(1));
+    EXPECT_EQ(0, _M_hash.size());
+    EXPECT_TRUE(_M_hash.insert({1, 30}));
+    EXPECT_EQ(std::optional<int>(30), _M_hash.find(1));
+}
+
+TEST_F(SplitOrderedHashTableTest, GrowOnlyDoublesTheIndex)
+{
+    for (int i = 0; i < 1000; ++i)
+    {
+        _M_hash.insert({i, i});
+    }
+    EXPECT_EQ(1000, _M_hash.size());
+    EXPECT_LE(512, _M_hash.bucket_count());
+    for (int i = 0; i < 1000; ++i)
+    {
+        EXPECT_EQ(std::optional<int>(i), _M_hash.find(i));
+    }
+    EXPECT_FALSE(_M_hash.find(1000));
+    for (int i = 0; i < 1000; i += 2)
+    {
+        EXPECT_TRUE(_M_hash.erase(i));
+    }
+    EXPECT_EQ(500, _M_hash.size());
+    for (int i = 0; i < 1000; ++i)
+    {
+        EXPECT_EQ(i % 2 == 1, _M_hash.find(i).has_value());
+    }
+}
+
+TEST_F(SplitOrderedHashTableTest, ConcurrentInsertErase)
+{
+    constexpr int threads = 4;
+    constexpr int per_thread = 5000;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([this, t]() {
+            for (int i = 0; i < per_thread; ++i)
+            {
+                // the shared keys race between the threads, the own keys are erased again
+                _M_hash.insert({(i % 2) ? i : t * per_thread + i + per_thread, i});
+                if (i % 4 == 0)
+                {
+                    EXPECT_TRUE(_M_hash.erase(t * per_thread + i + per_thread));
+                }
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    size_t expected = per_thread / 2 + threads * per_thread / 4;
+    EXPECT_EQ(expected, _M_hash.size());
+    for (int i = 1; i < per_thread; i += 2)
+    {
+        EXPECT_TRUE(_M_hash.find(i));
+    }
 }
 
 class VecTableTest : public testing::Test
@@ -139,3 +344,972 @@ TEST_F(SetLockFreeTest, erase_values)
     }
 }
 
+
+TEST_F(SetLockFreeTest, erase_reclaims_nodes)
+{
+    auto &domain = memory::EpochDomain::instance();
+    domain.collect();
+    auto before = domain.pending();
+    for (int round = 0; round < 10000; ++round)
+    {
+        for (int v = 0; v < 8; ++v)
+        {
+            _M_set.insert(v);
+        }
+        for (int v = 0; v < 8; ++v)
+        {
+            EXPECT_EQ(1, _M_set.erase(v));
+        }
+    }
+    EXPECT_EQ(0, _M_set.size());
+    EXPECT_EQ(_M_set.end(), _M_set.begin());
+    EXPECT_GT(before + 256, domain.pending());
+}
+
+TEST_F(SetLockFreeTest, concurrent_erase_and_find)
+{
+    constexpr int keys = 64;
+    std::atomic<bool> done = false;
+    auto churn = [&](int offset) {
+        for (int round = 0; round < 2000; ++round)
+        {
+            for (int v = offset; v < keys; v += 2)
+            {
+                _M_set.insert(v);
+            }
+            for (int v = offset; v < keys; v += 2)
+            {
+                _M_set.erase(v);
+            }
+        }
+    };
+    auto reader = std::thread([&]() {
+        while (!done)
+        {
+            memory::EpochGuard guard;
+            for (auto it = _M_set.begin(); it != _M_set.end(); ++it)
+            {
+                EXPECT_GT(keys, *it);
+            }
+        }
+    });
+    auto th1 = std::thread(churn, 0);
+    auto th2 = std::thread(churn, 1);
+    th1.join();
+    th2.join();
+    done = true;
+    reader.join();
+    EXPECT_EQ(0, _M_set.size());
+    EXPECT_EQ(_M_set.end(), _M_set.begin());
+}
+
+TEST_F(SetLockFreeTest, find_while_erase_without_a_guard)
+{
+    constexpr int keys = 64;
+    std::atomic<bool> done = false;
+    auto churn = [&]() {
+        for (int round = 0; round < 2000; ++round)
+        {
+            for (int v = 0; v < keys; ++v)
+            {
+                _M_set.insert(v);
+            }
+            for (int v = 0; v < keys; ++v)
+            {
+                _M_set.erase(v);
+            }
+        }
+    };
+    // the returned iterators are only compared, never dereferenced
+    auto reader = std::thread([&]() {
+        while (!done)
+        {
+            for (int v = 0; v < keys; ++v)
+            {
+                _M_set.find(v);
+            }
+            EXPECT_EQ(_M_set.end(), _M_set.find(keys));
+        }
+    });
+    auto writer = std::thread(churn);
+    churn();
+    writer.join();
+    done = true;
+    reader.join();
+    EXPECT_EQ(0, _M_set.size());
+}
+
+TEST_F(SetLockFreeTest, values_are_kept_in_order)
+{
+    for (int v : {5, 1, 4, 2, 3, 0})
+    {
+        _M_set.insert(v);
+    }
+    EXPECT_EQ(1, _M_set.erase(4));
+    EXPECT_EQ(0, _M_set.insert(3));
+    std::vector<int> values;
+    for (auto it = _M_set.begin(); it != _M_set.end(); ++it)
+    {
+        values.push_back(*it);
+    }
+    // std::hash<int> is the identity, the chain is sorted by value
+    EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 5}), values);
+    EXPECT_EQ(_M_set.end(), _M_set.find(4));
+}
+
+TEST_F(SetLockFreeTest, concurrent_insert_erase_same_keys)
+{
+    constexpr int keys = 32;
+    std::atomic<int> balance = 0;
+    auto churn = [&]() {
+        for (int round = 0; round < 2000; ++round)
+        {
+            for (int v = 0; v < keys; ++v)
+            {
+                balance += static_cast<int>(_M_set.insert(v));
+            }
+            for (int v = keys - 1; v >= 0; --v)
+            {
+                balance -= static_cast<int>(_M_set.erase(v));
+            }
+        }
+    };
+    auto th1 = std::thread(churn);
+    auto th2 = std::thread(churn);
+    th1.join();
+    th2.join();
+    EXPECT_EQ(balance.load(), static_cast<int>(_M_set.size()));
+    int previous = -1;
+    for (auto it = _M_set.begin(); it != _M_set.end(); ++it)
+    {
+        EXPECT_LT(previous, *it);
+        previous = *it;
+    }
+}
+
+// std::hash<int> that counts its calls
+struct counting_order
+{
+    static std::atomic<int> calls;
+
+    std::uint64_t operator()(int value) const
+    {
+        ++calls;
+        return static_cast<std::uint64_t>(value);
+    }
+};
+std::atomic<int> counting_order::calls = 0;
+
+TEST(SetOrderTest, OrderIsComputedOncePerOperation)
+{
+    lf::set<int, std::equal_to<int>, std::allocator<int>, std::atomic<std::size_t>, counting_order> set;
+    for (int v = 0; v < 100; ++v)
+    {
+        set.insert(v);
+    }
+    // the walks compare the order kept in the nodes
+    counting_order::calls = 0;
+    EXPECT_NE(set.end(), set.find(99));
+    EXPECT_EQ(set.end(), set.find(100));
+    EXPECT_EQ(0, set.insert(50));
+    EXPECT_EQ(1, set.erase(98));
+    EXPECT_EQ(4, counting_order::calls.load());
+}
+
+TEST(ListLockFreeTest, erase_unlinks_node)
+{
+    lf::list<int> list;
+    for (int v = 0; v < 5; ++v)
+    {
+        list.append(v);
+    }
+    auto it = list.begin();
+    ++it;
+    list.erase(it);
+    std::vector<int> values;
+    for (auto v = list.begin(); v != list.end(); ++v)
+    {
+        values.push_back(*v);
+    }
+    EXPECT_EQ((std::vector<int>{4, 2, 1, 0}), values);
+}
+
+// stateful and not default constructible, counts the nodes it has handed out
+template <typename T> struct tracking_allocator
+{
+    using value_type = T;
+
+    explicit tracking_allocator(std::atomic<int> *live) : _M_live(live)
+    {
+    }
+
+    template <typename U> tracking_allocator(const tracking_allocator<U> &other) : _M_live(other._M_live)
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        ++*_M_live;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *ptr, std::size_t n)
+    {
+        --*_M_live;
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <typename U> bool operator==(const tracking_allocator<U> &other) const
+    {
+        return _M_live == other._M_live;
+    }
+
+    template <typename U> bool operator!=(const tracking_allocator<U> &other) const
+    {
+        return _M_live != other._M_live;
+    }
+
+    std::atomic<int> *_M_live;
+};
+
+// enough epoch steps for every retired node to be freed
+static void drain_epochs()
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        memory::EpochDomain::instance().collect();
+    }
+}
+
+TEST(ListLockFreeTest, retired_nodes_go_back_to_their_allocator)
+{
+    std::atomic<int> live{0};
+    {
+        lf::list<int, tracking_allocator<int>> list(tracking_allocator<int>{&live});
+        for (int v = 0; v < 100; ++v)
+        {
+            list.append(v);
+        }
+        for (int v = 0; v < 100; ++v)
+        {
+            auto it = list.begin();
+            list.erase(it);
+        }
+        drain_epochs();
+        // only the end node is left
+        EXPECT_EQ(1, live.load());
+    }
+    EXPECT_EQ(0, live.load());
+}
+
+TEST(SplitOrderedAllocatorTest, RetiredNodesGoBackToTheirAllocator)
+{
+    std::atomic<int> live{0};
+    {
+        lf::SplitOrderedHashTable<int, int, std::hash<int>, std::equal_to<int>,
+                                  tracking_allocator<std::pair<int, int>>>
+            table(16, tracking_allocator<std::pair<int, int>>{&live});
+        for (int v = 0; v < 100; ++v)
+        {
+            table.insert({v, v});
+        }
+        for (int v = 0; v < 100; ++v)
+        {
+            // splices the dummy node of every bucket in use
+            EXPECT_TRUE(table.find(v));
+        }
+        const auto filled = live.load();
+        for (int v = 0; v < 100; ++v)
+        {
+            EXPECT_TRUE(table.erase(v));
+        }
+        drain_epochs();
+        EXPECT_EQ(filled - 100, live.load());
+    }
+    EXPECT_EQ(0, live.load());
+}
+
+TEST(ShardedCounterTest, SumsEveryThread)
+{
+    constexpr int threads = 4;
+    constexpr int count = 10000;
+    lf::sharded_counter<std::size_t> counter;
+    // the default counter of a standalone set
+    lf::set<int> set;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t]() {
+            for (int i = 0; i < count; ++i)
+            {
+                ++counter;
+            }
+            // a set is a single chain, keep it short
+            for (int i = 0; i < 500; ++i)
+            {
+                set.insert(t * count + i);
+            }
+            for (int i = 0; i < count / 2; ++i)
+            {
+                --counter;
+            }
+            // the thread always sees its own updates
+            EXPECT_GE(counter.approx(), static_cast<std::size_t>(count / 2));
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    EXPECT_EQ(threads * count / 2, counter.load());
+    EXPECT_NEAR(threads * count / 2, counter.approx(), threads * 32);
+    EXPECT_EQ(threads * 500, set.size());
+}
+
+// a table of 16 buckets, shared by the typed suites below, each with its own list of tables
+template <typename Table> class TableTest : public testing::Test
+{
+  protected:
+    TableTest() : _M_hash(1 << 4)
+    {
+    }
+
+    // runs a whole scan and returns how many times every key was seen
+    std::vector<int> scan_all(int keys)
+    {
+        std::vector<int> seen(keys);
+        std::uint64_t cursor = 0;
+        do
+        {
+            cursor = _M_hash.scan(cursor, [&](int key, long value) {
+                EXPECT_EQ(key, value);
+                if (key < keys)
+                {
+                    ++seen[key];
+                }
+            });
+        } while (cursor != 0);
+        return seen;
+    }
+
+    Table _M_hash;
+};
+
+template <typename Table> using BatchTest = TableTest<Table>;
+using BatchTables = testing::Types<lf::HashTable<int, int>, lf::FlatHashTable<int, int>>;
+TYPED_TEST_SUITE(BatchTest, BatchTables);
+
+TYPED_TEST(BatchTest, InsertFindEraseBatch)
+{
+    // 100 keys cross several groups and grow the table from 16 buckets
+    std::vector<std::pair<int, int>> values;
+    std::vector<int> keys;
+    for (int i = 0; i < 100; ++i)
+    {
+        values.push_back({i, i});
+        keys.push_back(i);
+    }
+    EXPECT_EQ(100, this->_M_hash.insert_batch(values));
+    EXPECT_EQ(0, this->_M_hash.insert_batch(values));
+    EXPECT_EQ(100, this->_M_hash.size());
+
+    std::vector<int> odd;
+    for (int i = 1; i < 200; i += 2)
+    {
+        odd.push_back(i);
+    }
+    EXPECT_EQ(50, this->_M_hash.erase_batch(odd));
+
+    std::vector<bool> found;
+    this->_M_hash.find_batch(keys, std::back_inserter(found));
+    ASSERT_EQ(keys.size(), found.size());
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(i % 2 == 0, found[i]);
+    }
+}
+
+TEST(XHashTableTest, BatchMatchesSingleKeyCalls)
+{
+    xhash_table<int, int> table;
+    std::vector<std::pair<int, int>> values;
+    for (int i = 0; i < 40; ++i)
+    {
+        values.push_back({i, i * 10});
+    }
+    EXPECT_EQ(40, table.insert_batch(values));
+    EXPECT_EQ(0, table.insert_batch(values));
+
+    std::vector<int> keys = {0, 5, 39, 40, 77};
+    std::vector<xhash_table<int, int>::iterator> found;
+    table.find_batch(keys, std::back_inserter(found));
+    ASSERT_EQ(keys.size(), found.size());
+    EXPECT_EQ(50, found[1]->second);
+    EXPECT_EQ(390, found[2]->second);
+    EXPECT_EQ(table.end(), found[3]);
+    EXPECT_EQ(table.end(), found[4]);
+
+    EXPECT_EQ(3, table.erase_batch(keys));
+    EXPECT_EQ(table.end(), table.find(5));
+    EXPECT_NE(table.end(), table.find(6));
+}
+
+TEST(XHashTableTest, GrowKeepsElements)
+{
+    xhash_table<int, int> table;
+    for (int i = 0; i < 10000; ++i)
+    {
+        EXPECT_EQ(i, table.insert({i, i})->second);
+    }
+    EXPECT_EQ(10000, table.size());
+    EXPECT_EQ(0, table.insert({5, 0})->first - 5);
+    EXPECT_EQ(5, table.find(5)->second);
+    for (int i = 0; i < 10000; ++i)
+    {
+        ASSERT_NE(table.end(), table.find(i));
+    }
+    EXPECT_EQ(table.end(), table.find(10000));
+
+    size_t visited = 0;
+    for (auto &value : table)
+    {
+        EXPECT_EQ(value.first, value.second);
+        ++visited;
+    }
+    EXPECT_EQ(10000, visited);
+}
+
+TEST(XHashTableTest, TombstonesAreReused)
+{
+    xhash_table<std::string, int> table;
+    for (int round = 0; round < 1000; ++round)
+    {
+        for (int i = 0; i < 10; ++i)
+        {
+            table.insert({std::to_string(round * 10 + i), i});
+        }
+        for (int i = 0; i < 10; ++i)
+        {
+            table.erase(std::to_string(round * 10 + i));
+        }
+    }
+    EXPECT_EQ(0, table.size());
+    EXPECT_EQ(table.end(), table.begin());
+    EXPECT_GE(64, table.bucket_count());
+    table.insert({"key", 1});
+    EXPECT_EQ(1, table.find("key")->second);
+}
+
+TEST(XHashTableTest, MovesStealTheArrays)
+{
+    auto make = [](int count) {
+        xhash_table<std::string, int> table;
+        for (int i = 0; i < count; ++i)
+        {
+            table.insert({std::to_string(i), i});
+        }
+        return table;
+    };
+    std::vector<xhash_table<std::string, int>> tables;
+    tables.push_back(make(100));
+    tables.push_back(make(10));
+    EXPECT_EQ(100, tables[0].size());
+    EXPECT_EQ(42, tables[0].find("42")->second);
+
+    auto moved = std::move(tables[0]);
+    EXPECT_EQ(0, tables[0].size());
+    EXPECT_EQ(tables[0].end(), tables[0].begin());
+    EXPECT_EQ(99, moved.find("99")->second);
+    tables[0] = std::move(tables[1]);
+    EXPECT_EQ(10, tables[0].size());
+    EXPECT_EQ(9, tables[0].find("9")->second);
+}
+
+TEST(OrderedXHashTableTest, IteratesInInsertionOrder)
+{
+    ordered_xhash_table<std::string, int> table;
+    std::vector<std::string> order;
+    for (int i = 0; i < 1000; ++i)
+    {
+        // reversed digits, so the order is neither the hash nor the key order
+        auto key = std::to_string(i);
+        std::reverse(key.begin(), key.end());
+        key += "k";
+        if (table.insert({key, i})->second == i)
+        {
+            order.push_back(key);
+        }
+    }
+    EXPECT_EQ(order.size(), table.size());
+    EXPECT_EQ(0, table.insert({order[0], 5})->second);
+
+    // erase every third key, then insert one erased key again: it goes to the end
+    for (size_t i = 0; i < order.size(); i += 3)
+    {
+        EXPECT_NE(table.end(), table.find(order[i]));
+        table.erase(order[i]);
+        EXPECT_EQ(table.end(), table.find(order[i]));
+    }
+    EXPECT_EQ(table.end(), table.erase(order[0]));
+    std::vector<std::string> expected;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (i % 3)
+        {
+            expected.push_back(order[i]);
+        }
+    }
+    expected.push_back(order[3]);
+    table.insert({order[3], -1});
+
+    // growing past the erased pairs compacts them away without changing the order
+    for (int i = 0; i < 2000; ++i)
+    {
+        table.insert({"x" + std::to_string(i), i});
+        expected.push_back("x" + std::to_string(i));
+    }
+    std::vector<std::string> seen;
+    for (auto &value : table)
+    {
+        seen.push_back(value.first);
+    }
+    EXPECT_EQ(expected, seen);
+    EXPECT_EQ(-1, table.find(order[3])->second);
+    EXPECT_EQ(2, table.offset_width());
+}
+
+TEST(OrderedXHashTableTest, OffsetsWidenWithTheCapacity)
+{
+    ordered_xhash_table<int, int> table;
+    EXPECT_EQ(1, table.offset_width());
+    for (int i = 0; i < 100000; ++i)
+    {
+        table.insert({i, i});
+    }
+    EXPECT_EQ(4, table.offset_width());
+    auto it = table.begin();
+    for (int i = 0; i < 100000; ++i, ++it)
+    {
+        ASSERT_EQ(i, it->first);
+    }
+    EXPECT_EQ(table.end(), it);
+    EXPECT_EQ(6, table.erase(5)->first);
+}
+
+TEST(OrderedXHashTableTest, MoveLeavesTheSourceEmpty)
+{
+    ordered_xhash_table<int, int> table;
+    for (int i = 0; i < 100; ++i)
+    {
+        table.insert({i, i});
+    }
+    auto moved = std::move(table);
+    EXPECT_EQ(0, table.size());
+    EXPECT_EQ(table.end(), table.begin());
+    EXPECT_EQ(100, moved.size());
+    EXPECT_EQ(7, moved.find(7)->second);
+    table = std::move(moved);
+    EXPECT_EQ(100, table.size());
+    EXPECT_EQ(0, table.begin()->first);
+}
+
+TEST(PerfectHashMapTest, EveryKeyHasItsOwnSlot)
+{
+    std::vector<std::pair<std::string, int>> values;
+    for (int i = 0; i < 20000; ++i)
+    {
+        values.push_back({std::to_string(i * 7), i});
+    }
+    values.push_back({"7", -1});
+    perfect_hash_map<std::string, int> map(values.begin(), values.end());
+    EXPECT_EQ(20000, map.size());
+    for (int i = 0; i < 20000; ++i)
+    {
+        ASSERT_NE(nullptr, map.find(std::to_string(i * 7)));
+        EXPECT_EQ(i, *map.find(std::to_string(i * 7)));
+    }
+    EXPECT_EQ(nullptr, map.find("8"));
+    EXPECT_EQ(nullptr, map.find(""));
+    EXPECT_GT(4.5, map.bits_per_key());
+
+    std::vector<std::pair<int, int>> none;
+    perfect_hash_map<int, int> empty(none.begin(), none.end());
+    EXPECT_EQ(0, empty.size());
+    EXPECT_EQ(nullptr, empty.find(0));
+}
+
+TEST(PerfectHashMapTest, DefaultGammaSavesBits)
+{
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> values;
+    for (std::uint64_t key = 0; key < 50000; ++key)
+    {
+        values.push_back({key << 20, key});
+    }
+    perfect_hash_map<std::uint64_t, std::uint64_t> fast(values.begin(), values.end(), 2.0);
+    perfect_hash_map<std::uint64_t, std::uint64_t> small(values.begin(), values.end());
+    EXPECT_GT(fast.bits_per_key(), small.bits_per_key());
+    EXPECT_GT(3.6, small.bits_per_key());
+    for (const auto &value : values)
+    {
+        EXPECT_EQ(value.second, *small.find(value.first));
+    }
+    EXPECT_EQ(nullptr, small.find(1));
+}
+
+template <typename Table> using KeyValueTest = TableTest<Table>;
+using KeyValueTables =
+    testing::Types<lf::HashTable<int, long>, lf::FlatHashTable<int, long>, lf::PaddedHashTable<int, long>,
+                   lf::HashTable<int, long, std::hash<int>, std::equal_to<int>, memory::pool_allocator<std::pair<int, long>>>,
+                   lf::HashTable<int, long, std::hash<int>, std::equal_to<int>, memory::slab_allocator<std::pair<int, long>>>,
+                   lf::HashTable<int, long, std::hash<int>, std::equal_to<int>,
+                                 memory::huge_page_allocator<std::pair<int, long>>>,
+                   lf::PackedHashTable<long, long>>;
+TYPED_TEST_SUITE(KeyValueTest, KeyValueTables);
+
+TYPED_TEST(KeyValueTest, FindReturnsTheValue)
+{
+    EXPECT_TRUE(this->_M_hash.insert({1, 10}));
+    EXPECT_FALSE(this->_M_hash.insert({1, 20}));
+    EXPECT_EQ(10, this->_M_hash.find(1).value());
+    EXPECT_FALSE(this->_M_hash.find(2).has_value());
+
+    EXPECT_FALSE(this->_M_hash.upsert(1, 30));
+    EXPECT_EQ(30, this->_M_hash.find(1).value());
+    EXPECT_TRUE(this->_M_hash.upsert(2, 40));
+    EXPECT_EQ(40, this->_M_hash.find(2).value());
+    EXPECT_EQ(2, this->_M_hash.size());
+
+    int calls = 0;
+    auto make = [&](int key) {
+        ++calls;
+        return key * 100L;
+    };
+    EXPECT_EQ(300, this->_M_hash.compute_if_absent(3, make));
+    EXPECT_EQ(300, this->_M_hash.compute_if_absent(3, make));
+    EXPECT_EQ(1, calls);
+}
+
+TYPED_TEST(KeyValueTest, ConcurrentCountersSurviveGrow)
+{
+    // few buckets and many keys: the counters are bumped while the table resizes
+    constexpr int threads = 4;
+    constexpr int keys = 2000;
+    constexpr int rounds = 5;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([this]() {
+            for (int round = 0; round < rounds; ++round)
+            {
+                for (int key = 0; key < keys; ++key)
+                {
+                    this->_M_hash.fetch_add(key, 1);
+                }
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    EXPECT_EQ(keys, this->_M_hash.size());
+    for (int key = 0; key < keys; ++key)
+    {
+        EXPECT_EQ(threads * rounds, this->_M_hash.find(key).value());
+    }
+    EXPECT_EQ(threads * rounds, this->_M_hash.fetch_add(0, 5));
+    EXPECT_EQ(0, this->_M_hash.fetch_add(keys, 5));
+}
+
+TYPED_TEST(KeyValueTest, ReadersSeeEveryKeyDuringGrow)
+{
+    // readers never pin the table with a shared write, the retired tables must stay readable
+    constexpr int readers = 3;
+    constexpr int keys = 4000;
+    for (int key = 0; key < 64; ++key)
+    {
+        this->_M_hash.insert({key, key});
+    }
+    std::atomic_bool done = false;
+    std::atomic_int missing = 0;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < readers; ++t)
+    {
+        workers.emplace_back([&]() {
+            while (!done.load())
+            {
+                for (int key = 0; key < 64; ++key)
+                {
+                    auto value = this->_M_hash.find(key);
+                    missing += !value || *value != key;
+                }
+            }
+        });
+    }
+    for (int key = 64; key < keys; ++key)
+    {
+        this->_M_hash.insert({key, key});
+    }
+    done.store(true);
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    EXPECT_EQ(0, missing.load());
+    EXPECT_EQ(keys, this->_M_hash.size());
+}
+
+TYPED_TEST(KeyValueTest, BulkBuildKeepsFirstValue)
+{
+    // 3 threads over 60000 pairs, the second half repeats every key with another value; sized once, never grown
+    constexpr int keys = 30000;
+    std::vector<std::pair<int, long>> values;
+    for (int round = 0; round < 2; ++round)
+    {
+        for (int key = 0; key < keys; ++key)
+        {
+            values.push_back({key, key + round * keys});
+        }
+    }
+    TypeParam table(values.begin(), values.end(), 3);
+    EXPECT_EQ(keys, table.size());
+    EXPECT_EQ(1 << 17, table.bucket_count());
+    for (int key = 0; key < keys; ++key)
+    {
+        EXPECT_EQ(key, table.find(key).value());
+    }
+    EXPECT_FALSE(table.find(keys).has_value());
+    EXPECT_TRUE(table.insert({keys, 0}));
+    EXPECT_EQ(0, TypeParam(values.begin(), values.begin()).size());
+}
+
+TEST(PaddedHashTableTest, BucketsOwnACacheLine)
+{
+    using policy = lf::PaddedChainingPolicy<int, long, std::equal_to<int>, std::allocator<std::pair<int, long>>>;
+    EXPECT_EQ(lf::cache_line_size, alignof(policy::bucket_type));
+    EXPECT_EQ(lf::cache_line_size, sizeof(policy::bucket_type));
+
+    policy::table_type table(4);
+    auto first = reinterpret_cast<std::uintptr_t>(&table[0]);
+    EXPECT_EQ(0, first % lf::cache_line_size);
+    EXPECT_EQ(lf::cache_line_size, reinterpret_cast<std::uintptr_t>(&table[1]) - first);
+}
+
+TEST(PackedHashTableTest, EightByteKeysAndValuesUsePairSlots)
+{
+    using packed = lf::PackedPolicy<std::uint64_t, double, std::equal_to<std::uint64_t>, std::allocator<int>>;
+    using flat = lf::PackedPolicy<int, long, std::equal_to<int>, std::allocator<int>>;
+    EXPECT_TRUE((std::is_same_v<lf::pair_slot, packed::slot_type>));
+    EXPECT_FALSE((std::is_same_v<lf::pair_slot, flat::slot_type>));
+    EXPECT_EQ(16, sizeof(packed::slot_type));
+    EXPECT_EQ(16, alignof(packed::slot_type));
+
+    lf::PackedHashTable<std::uint64_t, double> table(4);
+    EXPECT_TRUE(table.insert({0, 0.5}));
+    EXPECT_TRUE(table.insert({7, 1.5}));
+    EXPECT_EQ(0.5, table.find(0).value());
+    EXPECT_TRUE(table.erase(7));
+    EXPECT_FALSE(table.erase(7));
+    EXPECT_FALSE(table.find(7).has_value());
+    EXPECT_FALSE(table.upsert(0, 2.5));
+    // the tombstone of 7 is taken back by the same key
+    EXPECT_TRUE(table.insert({7, 3.5}));
+    EXPECT_EQ(3.5, table.find(7).value());
+    EXPECT_EQ(2.5, table.fetch_add(0, 1.0));
+    EXPECT_EQ(3.5, table.find(0).value());
+    EXPECT_EQ(2, table.size());
+}
+
+TEST(PackedHashTableTest, ReservedBitPatternsAreRejected)
+{
+    constexpr auto ones = ~std::uint64_t(0);
+    lf::PackedHashTable<std::uint64_t, std::uint64_t> table(4);
+    EXPECT_THROW(table.insert({ones, 1}), std::invalid_argument);
+    EXPECT_THROW(table.insert({5, ones}), std::invalid_argument);
+    EXPECT_THROW(table.insert({6, ones - 2}), std::invalid_argument);
+    EXPECT_THROW(table.upsert(ones, 1), std::invalid_argument);
+    EXPECT_EQ(0, table.size());
+    EXPECT_FALSE(table.find(5).has_value());
+
+    EXPECT_TRUE(table.insert({5, ones - 3}));
+    EXPECT_EQ(ones - 3, table.find(5).value());
+    EXPECT_THROW(table.fetch_add(5, 1), std::invalid_argument);
+    EXPECT_THROW(table.upsert(5, ones - 1), std::invalid_argument);
+    EXPECT_EQ(ones - 3, table.find(5).value());
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> input{{1, 1}, {2, ones}};
+    EXPECT_THROW((lf::PackedHashTable<std::uint64_t, std::uint64_t>(input.begin(), input.end())),
+                 std::invalid_argument);
+}
+
+template <typename Table> using ScanTest = TableTest<Table>;
+using ScanTables = testing::Types<lf::HashTable<int, long>, lf::FlatHashTable<int, long>, lf::PaddedHashTable<int, long>,
+                                  lf::PackedHashTable<long, long>>;
+TYPED_TEST_SUITE(ScanTest, ScanTables);
+
+TYPED_TEST(ScanTest, VisitsEveryKeyOnce)
+{
+    EXPECT_EQ(std::vector<int>(), this->scan_all(0));
+    constexpr int keys = 1000;
+    for (int key = 0; key < keys; ++key)
+    {
+        this->_M_hash.insert({key, key});
+    }
+    EXPECT_EQ(std::vector<int>(keys, 1), this->scan_all(keys));
+}
+
+TYPED_TEST(ScanTest, StableKeysSurviveConcurrentGrow)
+{
+    // the table grows from 16 buckets while the scan is running
+    constexpr int stable = 200;
+    constexpr int keys = 20000;
+    for (int key = 0; key < stable; ++key)
+    {
+        this->_M_hash.insert({key, key});
+    }
+    std::atomic<bool> done = false;
+    auto writer = std::thread([&]() {
+        for (int key = stable; key < keys && !done; ++key)
+        {
+            this->_M_hash.insert({key, key});
+            if (key % 3 == 0)
+            {
+                this->_M_hash.erase(key - 1);
+            }
+        }
+    });
+    for (int round = 0; round < 20; ++round)
+    {
+        auto seen = this->scan_all(stable);
+        EXPECT_EQ(stable, std::count_if(seen.begin(), seen.end(), [](int count) { return count > 0; }));
+    }
+    done = true;
+    writer.join();
+}
+
+template <typename Table> using ResizeTest = TableTest<Table>;
+using ResizeTables =
+    testing::Types<lf::HashTable<int, int>, lf::FlatHashTable<int, int>, lf::SplitOrderedHashTable<int, int>,
+                   lf::PackedHashTable<long, long>,
+                   lf::HashTable<int, int, std::hash<int>, std::equal_to<int>, memory::slab_allocator<std::pair<int, int>>>>;
+TYPED_TEST_SUITE(ResizeTest, ResizeTables);
+
+TYPED_TEST(ResizeTest, ReadersSeeStableKeysDuringGrow)
+{
+    constexpr int stable = 1000;
+    constexpr int writers = 3;
+    constexpr int per_writer = 20000;
+    for (int i = 0; i < stable; ++i)
+    {
+        this->_M_hash.insert({i, i});
+    }
+
+    std::atomic<bool> done = false;
+    std::atomic<int> misses = 0;
+    std::thread reader([&]() {
+        while (!done.load())
+        {
+            for (int i = 0; i < stable; ++i)
+            {
+                if (!this->_M_hash.find(i))
+                {
+                    ++misses;
+                }
+            }
+        }
+    });
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < writers; ++t)
+    {
+        workers.emplace_back([&, t]() {
+            const int first = stable + t * per_writer;
+            for (int i = first; i < first + per_writer; ++i)
+            {
+                this->_M_hash.insert({i, i});
+                // erase every other key again so erases also race the migration
+                if (i % 2)
+                {
+                    EXPECT_TRUE(this->_M_hash.erase(i));
+                }
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    done.store(true);
+    reader.join();
+
+    EXPECT_EQ(0, misses.load());
+    EXPECT_EQ(stable + writers * per_writer / 2, this->_M_hash.size());
+    for (int i = stable; i < stable + writers * per_writer; ++i)
+    {
+        EXPECT_EQ(i % 2 == 0, static_cast<bool>(this->_M_hash.find(i)));
+    }
+}
+
+TEST(FrozenHashTableTest, ImageAnswersLikeTheTable)
+{
+    lf::HashTable<int, long> table(1 << 4);
+    xhash_table<int, long> scratch;
+    for (int key = 0; key < 5000; ++key)
+    {
+        table.insert({key, key * 3L});
+        scratch.insert({key, key * 3L});
+    }
+    using frozen = lf::FrozenHashTable<int, long>;
+    const auto image = frozen::freeze(table);
+    // the same keys give an image of the same shape whatever the source
+    const auto copy = frozen::build(scratch.begin(), scratch.end());
+    EXPECT_EQ(image.size(), copy.size());
+
+    for (const auto &bytes : {image, copy})
+    {
+        frozen view(bytes.data(), bytes.size());
+        ASSERT_TRUE(view.valid());
+        EXPECT_EQ(5000, view.size());
+        EXPECT_EQ(8192, view.bucket_count());
+        for (int key = 0; key < 5000; ++key)
+        {
+            EXPECT_EQ(key * 3L, view.find(key).value());
+        }
+        EXPECT_FALSE(view.find(5000).has_value());
+        EXPECT_FALSE(view.find(-1).has_value());
+    }
+}
+
+TEST(FrozenHashTableTest, OpenMapsTheFile)
+{
+    std::vector<std::pair<std::uint64_t, double>> values;
+    for (std::uint64_t key = 0; key < 1000; ++key)
+    {
+        values.push_back({key * key, key / 2.0});
+    }
+    values.push_back({4, -1.0});
+    using frozen = lf::FrozenHashTable<std::uint64_t, double>;
+    const auto path = testing::TempDir() + "frozen_table.img";
+    ASSERT_TRUE(frozen::write(path.c_str(), frozen::build(values.begin(), values.end())));
+
+    auto table = frozen::open(path.c_str());
+    ASSERT_TRUE(table.valid());
+    EXPECT_EQ(1000, table.size());
+    EXPECT_EQ(1024, table.bucket_count());
+    // the first value of a repeated key wins
+    EXPECT_EQ(1.0, table.find(4).value());
+    EXPECT_EQ(499.5, table.find(999 * 999).value());
+    EXPECT_FALSE(table.find(3).has_value());
+
+    frozen moved = std::move(table);
+    EXPECT_FALSE(table.valid());
+    EXPECT_EQ(0.5, moved.find(1).value());
+
+    // another layout or a truncated file is refused
+    using narrow = lf::FrozenHashTable<std::uint64_t, float>;
+    EXPECT_FALSE(narrow::open(path.c_str()).valid());
+    const auto image = frozen::build(values.begin(), values.end());
+    EXPECT_FALSE(frozen(image.data(), image.size() - 1).valid());
+    EXPECT_FALSE(frozen::open((path + ".missing").c_str()).valid());
+    std::remove(path.c_str());
+}
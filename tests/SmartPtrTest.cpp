@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 #include "memory.hpp"
+#include "list.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 TEST(SmartPtr, Test1)
 {
@@ -35,3 +40,486 @@ TEST_F(WrapPtrTest, RefCountTest)
         EXPECT_FALSE(ptr);
     }
 }
+
+struct HazardObject
+{
+    explicit HazardObject(int value, std::atomic<int> *destroyed = nullptr) : _M_value(value), _M_destroyed(destroyed)
+    {
+    }
+
+    ~HazardObject()
+    {
+        if (_M_destroyed)
+        {
+            ++*_M_destroyed;
+        }
+    }
+
+    int _M_value;
+    std::atomic<int> *_M_destroyed;
+};
+
+TEST(HazardPointerTest, ProtectedObjectSurvivesScan)
+{
+    auto &domain = memory::HazardDomain::instance();
+    std::atomic<int> destroyed = 0;
+    std::atomic<HazardObject *> shared = new HazardObject(1, &destroyed);
+
+    memory::HazardPointer hazard;
+    auto obj = hazard.protect(shared);
+    shared.store(new HazardObject(2, &destroyed));
+    domain.retire(obj);
+    domain.scan();
+    EXPECT_EQ(0, destroyed);
+    EXPECT_EQ(1, obj->_M_value);
+
+    hazard.reset();
+    domain.scan();
+    EXPECT_EQ(1, destroyed);
+    delete shared.load();
+}
+
+TEST(HazardPointerTest, MoreHazardsThanSlots)
+{
+    constexpr int count = 3 * memory::HazardDomain::SLOTS + 1;
+    auto &domain = memory::HazardDomain::instance();
+    std::atomic<int> destroyed = 0;
+    std::vector<std::atomic<HazardObject *>> shared(count);
+    std::vector<std::unique_ptr<memory::HazardPointer>> hazards;
+    for (int i = 0; i < count; ++i)
+    {
+        shared[i].store(new HazardObject(i, &destroyed));
+        hazards.push_back(std::make_unique<memory::HazardPointer>());
+        domain.retire(hazards.back()->protect(shared[i]));
+    }
+    domain.scan();
+    EXPECT_EQ(0, destroyed);
+    for (int i = 0; i < count; ++i)
+    {
+        EXPECT_EQ(i, shared[i].load()->_M_value);
+    }
+
+    hazards.clear();
+    domain.scan();
+    EXPECT_EQ(count, destroyed);
+}
+
+TEST(HazardPointerTest, StalledReaderKeepsGarbageBounded)
+{
+    auto &domain = memory::HazardDomain::instance();
+    std::atomic<HazardObject *> shared = new HazardObject(0);
+    std::atomic<bool> published = false;
+    std::atomic<bool> done = false;
+
+    // the reader publishes one pointer and then never makes progress
+    auto reader = std::thread([&]() {
+        memory::HazardPointer hazard;
+        auto obj = hazard.protect(shared);
+        published = true;
+        while (!done)
+        {
+            std::this_thread::yield();
+        }
+        EXPECT_EQ(0, obj->_M_value);
+    });
+    while (!published)
+    {
+        std::this_thread::yield();
+    }
+
+    auto before = domain.pending();
+    for (int i = 1; i <= 100000; ++i)
+    {
+        domain.retire(shared.exchange(new HazardObject(i)));
+    }
+    EXPECT_GT(before + 1024, domain.pending());
+
+    done = true;
+    reader.join();
+    delete shared.load();
+}
+
+TEST(HazardPointerTest, ConcurrentReadersAndWriter)
+{
+    std::atomic<HazardObject *> shared = new HazardObject(0);
+    std::atomic<bool> done = false;
+    auto read = [&]() {
+        memory::HazardPointer hazard;
+        while (!done)
+        {
+            auto obj = hazard.protect(shared);
+            EXPECT_LE(0, obj->_M_value);
+            hazard.reset();
+        }
+    };
+    auto r1 = std::thread(read);
+    auto r2 = std::thread(read);
+    for (int i = 1; i <= 20000; ++i)
+    {
+        memory::HazardDomain::instance().retire(shared.exchange(new HazardObject(i)));
+    }
+    done = true;
+    r1.join();
+    r2.join();
+    delete shared.load();
+}
+
+struct PoolNode
+{
+    PoolNode *_M_next;
+    int _M_value;
+};
+
+TEST(NodePoolTest, FreedBlockIsReused)
+{
+    memory::pool_allocator<PoolNode> allocator;
+    auto first = allocator.allocate(1);
+    allocator.deallocate(first, 1);
+    auto second = allocator.allocate(1);
+    EXPECT_EQ(first, second);
+    allocator.deallocate(second, 1);
+
+    auto array = allocator.allocate(8);
+    EXPECT_NE(nullptr, array);
+    allocator.deallocate(array, 8);
+}
+
+TEST(NodePoolTest, RemoteFreesFlowBackThroughTheDepot)
+{
+    constexpr std::size_t count = 4 * memory::NodePool<sizeof(PoolNode), alignof(PoolNode)>::MAGAZINE;
+    memory::pool_allocator<PoolNode> allocator;
+    std::vector<PoolNode *> nodes;
+    auto producer = std::thread([&]() {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            nodes.push_back(allocator.allocate(1));
+            nodes.back()->_M_value = static_cast<int>(i);
+        }
+    });
+    producer.join();
+
+    // freed here, the magazines go to the depot and the next thread refills from them
+    for (auto node : nodes)
+    {
+        allocator.deallocate(node, 1);
+    }
+    std::vector<PoolNode *> reused;
+    auto consumer = std::thread([&]() {
+        for (std::size_t i = 0; i < memory::NodePool<sizeof(PoolNode), alignof(PoolNode)>::MAGAZINE; ++i)
+        {
+            reused.push_back(allocator.allocate(1));
+        }
+    });
+    consumer.join();
+    std::sort(nodes.begin(), nodes.end());
+    for (auto node : reused)
+    {
+        EXPECT_TRUE(std::binary_search(nodes.begin(), nodes.end(), node));
+        allocator.deallocate(node, 1);
+    }
+}
+
+TEST(SlabAllocatorTest, SizeClassesRoundUp)
+{
+    EXPECT_EQ(16u, memory::SlabPool::class_size(memory::SlabPool::size_class(1)));
+    EXPECT_EQ(128u, memory::SlabPool::class_size(memory::SlabPool::size_class(128)));
+    EXPECT_EQ(160u, memory::SlabPool::class_size(memory::SlabPool::size_class(129)));
+    EXPECT_EQ(320u, memory::SlabPool::class_size(memory::SlabPool::size_class(257)));
+    EXPECT_EQ(memory::SlabPool::CLASSES - 1, memory::SlabPool::size_class(memory::SlabPool::MAX_SIZE));
+    for (std::size_t bytes = 1; bytes <= memory::SlabPool::MAX_SIZE; ++bytes)
+    {
+        const auto size = memory::SlabPool::class_size(memory::SlabPool::size_class(bytes));
+        EXPECT_GE(size, bytes);
+        EXPECT_EQ(0u, size % memory::SlabPool::ALIGN);
+    }
+
+    memory::slab_allocator<PoolNode> allocator;
+    auto first = allocator.allocate(1);
+    allocator.deallocate(first, 1);
+    auto second = allocator.allocate(1);
+    EXPECT_EQ(first, second);
+    allocator.deallocate(second, 1);
+
+    auto big = allocator.allocate(1000);
+    EXPECT_NE(nullptr, big);
+    allocator.deallocate(big, 1000);
+}
+
+TEST(SlabAllocatorTest, RemoteFreesReturnToTheOwner)
+{
+    struct Node
+    {
+        char _M_bytes[200];
+    };
+    constexpr std::size_t count = 100;
+    memory::slab_allocator<Node> allocator;
+    std::vector<Node *> nodes;
+    std::vector<Node *> reused;
+    std::atomic<bool> allocated = false;
+    std::atomic<bool> freed = false;
+    auto owner = std::thread([&]() {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            nodes.push_back(allocator.allocate(1));
+        }
+        std::sort(nodes.begin(), nodes.end());
+        allocated = true;
+        allocated.notify_one();
+        freed.wait(false);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            reused.push_back(allocator.allocate(1));
+        }
+    });
+    allocated.wait(false);
+    // freed by this thread onto the remote list of the owner slab
+    for (auto node : nodes)
+    {
+        allocator.deallocate(node, 1);
+    }
+    freed = true;
+    freed.notify_one();
+    owner.join();
+    for (auto node : reused)
+    {
+        EXPECT_TRUE(std::binary_search(nodes.begin(), nodes.end(), node));
+        allocator.deallocate(node, 1);
+    }
+}
+
+TEST(SlabAllocatorTest, AbandonedSlabsAreAdopted)
+{
+    struct Node
+    {
+        char _M_bytes[900];
+    };
+    constexpr std::size_t count = 16;
+    memory::slab_allocator<Node> allocator;
+    std::vector<Node *> nodes;
+    std::thread([&]() {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            nodes.push_back(allocator.allocate(1));
+        }
+    }).join();
+    for (auto node : nodes)
+    {
+        allocator.deallocate(node, 1);
+    }
+    std::sort(nodes.begin(), nodes.end());
+    std::thread([&]() {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            auto node = allocator.allocate(1);
+            EXPECT_TRUE(std::binary_search(nodes.begin(), nodes.end(), node));
+            allocator.deallocate(node, 1);
+        }
+    }).join();
+}
+
+TEST(MonotonicArenaTest, BumpsAlignedPointers)
+{
+    memory::MonotonicArena arena(256);
+    auto first = static_cast<char *>(arena.allocate(3, 1));
+    auto second = static_cast<char *>(arena.allocate(8, 8));
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(second) % 8);
+    EXPECT_LT(second - first, 16);
+    auto aligned = arena.allocate(64, 64);
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(aligned) % 64);
+
+    // bigger than the next block, it gets a block of its own size
+    auto big = arena.allocate(10000, 16);
+    EXPECT_NE(nullptr, big);
+    EXPECT_GE(arena.reserved(), 10000u + 256u);
+    arena.release();
+    EXPECT_EQ(0u, arena.reserved());
+}
+
+TEST(MonotonicArenaTest, ListNodesComeFromTheArena)
+{
+    memory::MonotonicArena arena;
+    {
+        List<int, memory::arena_allocator<int>> list{memory::arena_allocator<int>(arena)};
+        for (int i = 0; i < 100; ++i)
+        {
+            list.push_back(i);
+        }
+        auto it = list.find(42);
+        EXPECT_EQ(1u, list.erase(it));
+        EXPECT_EQ(99u, list.size());
+        EXPECT_EQ(0, *list.begin());
+    }
+    EXPECT_GT(arena.reserved(), 100 * sizeof(int));
+}
+
+TEST(HugePageAllocatorTest, BigArraysStartOnAHugePage)
+{
+    using allocator_type = memory::huge_page_allocator<std::uint64_t>;
+    constexpr std::size_t count = 3 * allocator_type::HUGE_PAGE / sizeof(std::uint64_t) + 5;
+    allocator_type allocator;
+    auto array = allocator.allocate(count);
+    ASSERT_NE(nullptr, array);
+#ifdef MEMORY_HUGE_PAGES
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(array) % allocator_type::HUGE_PAGE);
+#endif
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        array[i] = i;
+    }
+    EXPECT_EQ(count - 1, array[count - 1]);
+    allocator.deallocate(array, count);
+
+    // rebinding keeps the mode, small arrays come from std::allocator
+    using explicit_type = memory::huge_page_allocator<std::uint64_t, memory::page_mode::explicit_pages>;
+    using rebound = std::allocator_traits<explicit_type>::rebind_alloc<int>;
+    static_assert(std::is_same<rebound, memory::huge_page_allocator<int, memory::page_mode::explicit_pages>>::value);
+    rebound small{explicit_type{}};
+    auto few = small.allocate(16);
+    few[15] = 1;
+    small.deallocate(few, 16);
+    auto pages = small.allocate(allocator_type::HUGE_PAGE / sizeof(int));
+    pages[0] = 1;
+    small.deallocate(pages, allocator_type::HUGE_PAGE / sizeof(int));
+}
+
+TEST(AtomicCountedPtrTest, LoadStoreAndCompareExchange)
+{
+    std::atomic<int> destroyed = 0;
+    {
+        memory::atomic_counted_ptr<HazardObject> shared(memory::make_counted<HazardObject>(1, &destroyed));
+        auto first = shared.load();
+        EXPECT_EQ(1, first->_M_value);
+
+        shared.store(memory::make_counted<HazardObject>(2, &destroyed));
+        // the old object lives as long as first holds it
+        EXPECT_EQ(0, destroyed.load());
+        EXPECT_EQ(1, first->_M_value);
+        first.reset();
+        EXPECT_EQ(1, destroyed.load());
+
+        auto expected = memory::counted_ptr<HazardObject>();
+        EXPECT_FALSE(shared.compare_exchange_strong(expected, memory::make_counted<HazardObject>(3, &destroyed)));
+        EXPECT_EQ(2, expected->_M_value);
+        EXPECT_EQ(2, destroyed.load());
+        EXPECT_TRUE(shared.compare_exchange_strong(expected, memory::make_counted<HazardObject>(4, &destroyed)));
+        EXPECT_EQ(4, shared.load()->_M_value);
+        expected.reset();
+        EXPECT_EQ(3, destroyed.load());
+
+        auto previous = shared.exchange(memory::counted_ptr<HazardObject>());
+        EXPECT_EQ(4, previous->_M_value);
+        EXPECT_FALSE(shared.load());
+    }
+    EXPECT_EQ(4, destroyed.load());
+}
+
+TEST(AtomicCountedPtrTest, ReadersNeverSeeAFreedSnapshot)
+{
+    std::atomic<int> destroyed = 0;
+    std::atomic<bool> done = false;
+    constexpr int writes = 20000;
+    {
+        memory::atomic_counted_ptr<HazardObject> shared(memory::make_counted<HazardObject>(0, &destroyed));
+        auto read = [&]() {
+            int last = 0;
+            while (!done)
+            {
+                auto snapshot = shared.load();
+                // versions only move forward and the object is still alive
+                EXPECT_LE(last, snapshot->_M_value);
+                last = snapshot->_M_value;
+            }
+        };
+        auto r1 = std::thread(read);
+        auto r2 = std::thread(read);
+        for (int i = 1; i <= writes; ++i)
+        {
+            if (i % 2)
+            {
+                shared.store(memory::make_counted<HazardObject>(i, &destroyed));
+                continue;
+            }
+            auto expected = shared.load();
+            EXPECT_TRUE(shared.compare_exchange_strong(expected, memory::make_counted<HazardObject>(i, &destroyed)));
+        }
+        done = true;
+        r1.join();
+        r2.join();
+    }
+    EXPECT_EQ(writes + 1, destroyed.load());
+}
+
+TEST(BiasedRefCountTest, OwnerCountsLocally)
+{
+    auto counted = new memory::IntrusiveRefCount<int, memory::BiasedRefCount>(7);
+    counted->increment();
+    counted->increment();
+    EXPECT_EQ(counted->count(), 3u);
+    EXPECT_FALSE(counted->release());
+    EXPECT_FALSE(counted->release());
+    EXPECT_EQ(**counted, 7);
+    EXPECT_TRUE(counted->release());
+    delete counted;
+}
+
+using BiasedPtr = memory::SmartPtr<HazardObject, memory::BiasedRefCount>;
+
+TEST(BiasedRefCountTest, ForeignReleaseIsMergedByTheOwner)
+{
+    std::atomic<int> destroyed{0};
+    {
+        BiasedPtr ptr(1, &destroyed);
+        auto foreign = new BiasedPtr(ptr);
+        // the owner still counts ptr, the foreign release is queued to it
+        std::thread([foreign]() { delete foreign; }).join();
+        EXPECT_EQ(destroyed.load(), 0);
+        memory::BiasedRefCount::drain();
+        EXPECT_EQ(destroyed.load(), 0);
+    }
+    EXPECT_EQ(destroyed.load(), 1);
+}
+
+TEST(BiasedRefCountTest, ReleasesAfterTheOwnerExited)
+{
+    std::atomic<int> destroyed{0};
+    BiasedPtr *handed = nullptr;
+    std::thread([&]() {
+        BiasedPtr ptr(2, &destroyed);
+        handed = new BiasedPtr(ptr);
+    }).join();
+    EXPECT_EQ(destroyed.load(), 0);
+    delete handed;
+    EXPECT_EQ(destroyed.load(), 1);
+}
+
+TEST(BiasedRefCountTest, SharedAcrossThreads)
+{
+    constexpr int copies = 10000;
+    std::atomic<int> destroyed{0};
+    {
+        BiasedPtr ptr(3, &destroyed);
+        const BiasedPtr &shared = ptr;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+        {
+            threads.emplace_back([handed = new BiasedPtr(ptr), &shared]() {
+                for (int i = 0; i < copies; ++i)
+                {
+                    BiasedPtr copy(shared);
+                    EXPECT_EQ(copy->_M_value, 3);
+                }
+                delete handed;
+            });
+        }
+        for (int i = 0; i < copies; ++i)
+        {
+            BiasedPtr copy(ptr);
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        EXPECT_EQ(destroyed.load(), 0);
+    }
+    EXPECT_EQ(destroyed.load(), 1);
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include "constexpr_map.hpp"
+#include <string_view>
+
+using namespace std::literals;
+
+enum class MessageType : std::uint8_t
+{
+    Logon = 'A',
+    Heartbeat = '0',
+    NewOrder = 'D',
+    Cancel = 'F'
+};
+
+static constexpr auto fields = make_constexpr_hash_map<std::string_view, int>({
+    {"BeginString", 8},
+    {"BodyLength", 9},
+    {"MsgType", 35},
+    {"SenderCompID", 49},
+    {"TargetCompID", 56},
+    {"MsgSeqNum", 34},
+    {"SendingTime", 52},
+    {"CheckSum", 10},
+    {"MsgType", -1},
+});
+
+static constexpr auto names = make_constexpr_sorted_map<MessageType, std::string_view>({
+    {MessageType::NewOrder, "NewOrderSingle"},
+    {MessageType::Logon, "Logon"},
+    {MessageType::Cancel, "OrderCancelRequest"},
+    {MessageType::Heartbeat, "Heartbeat"},
+});
+
+// lookups on literal keys are constant expressions
+static_assert(*fields.find("MsgType") == 35, "first value of a repeated key");
+static_assert(fields.find("Price") == nullptr, "missing key");
+static_assert(fields.size() == 8, "repeated key counted once");
+static_assert(*names.find(MessageType::Cancel) == "OrderCancelRequest", "sorted lookup");
+static_assert(names.begin()->first == MessageType::Heartbeat, "kept in key order");
+
+TEST(ConstexprHashMapTest, RuntimeLookupsUseTheCompiledLayout)
+{
+    const std::string_view keys[] = {"BeginString", "BodyLength", "MsgType",     "SenderCompID",
+                                     "TargetCompID", "MsgSeqNum", "SendingTime", "CheckSum"};
+    const int tags[] = {8, 9, 35, 49, 56, 34, 52, 10};
+    for (size_t i = 0; i < std::size(keys); ++i)
+    {
+        std::string key(keys[i]);
+        ASSERT_NE(nullptr, fields.find(key));
+        EXPECT_EQ(tags[i], *fields.find(key));
+    }
+    EXPECT_FALSE(fields.contains("msgtype"));
+    EXPECT_FALSE(fields.contains(""));
+}
+
+TEST(ConstexprHashMapTest, IntegerKeysIncludingZero)
+{
+    constexpr auto squares = make_constexpr_hash_map<int, int>({{0, 0}, {1, 1}, {2, 4}, {3, 9}, {4, 16}, {5, 25},
+                                                                {6, 36}, {7, 49}, {8, 64}, {9, 81}, {-1, 1}});
+    static_assert(squares.capacity() == 16, "rounded up to a power of two");
+    for (int i = -1; i < 10; ++i)
+    {
+        EXPECT_EQ(i * i, *squares.find(i));
+    }
+    EXPECT_EQ(nullptr, squares.find(10));
+    EXPECT_EQ(nullptr, squares.find(-2));
+
+    constexpr auto one = make_constexpr_hash_map<int, int>({{0, 7}});
+    static_assert(*one.find(0) == 7 && !one.contains(1), "single key");
+}
+
+TEST(ConstexprSortedMapTest, IteratesInOrder)
+{
+    constexpr auto map = make_constexpr_sorted_map<int, char, std::greater<int>>({{1, 'a'}, {3, 'c'}, {2, 'b'}, {3, 'x'}});
+    std::string order;
+    for (const auto &entry : map)
+    {
+        order += entry.second;
+    }
+    EXPECT_EQ("cba", order);
+    EXPECT_EQ(3, map.size());
+    EXPECT_EQ(2, map.lower_bound(2)->first);
+    EXPECT_EQ(map.end(), map.lower_bound(0));
+    EXPECT_EQ(nullptr, map.find(4));
+    EXPECT_EQ("NewOrderSingle"sv, *names.find(MessageType::NewOrder));
+}
@@ -1,4 +1,5 @@
 #include "interval_tree.hpp"
+#include "memory.hpp"
 #include <gtest/gtest.h>
 
 TEST(IntervalTree, Insert)
@@ -115,3 +116,22 @@ TEST(IntervalTree, OSSearch)
         EXPECT_EQ(2, result.second);
     }
 }
+
+TEST(IntervalTree, ArenaAllocatedNodes)
+{
+    memory::MonotonicArena arena;
+    {
+        OSIntervalTree<int, int, memory::arena_allocator<int>> container{memory::arena_allocator<int>(arena)};
+        for (int i = 1; i <= 1000; ++i)
+        {
+            container.insert(i, i, 2);
+        }
+        auto result = container.os_search(7);
+        EXPECT_EQ(4, result.first->first);
+        EXPECT_EQ(1, result.second);
+        EXPECT_EQ(1, container.begin()->first);
+    }
+    EXPECT_GT(arena.reserved(), 1000 * sizeof(int));
+    arena.release();
+    EXPECT_EQ(0u, arena.reserved());
+}